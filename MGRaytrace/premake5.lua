@@ -12,6 +12,7 @@ project "MGRaytrace"
       "../Walnut/vendor/imgui",
       "../Walnut/vendor/glfw/include",
       "../Walnut/vendor/glm",
+      "../Walnut/vendor/stb_image",
 
       "../Walnut/Walnut/src",
 
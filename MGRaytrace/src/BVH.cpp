@@ -0,0 +1,686 @@
+#include "BVH.h"
+
+#include "Intersection.h"
+
+#include <algorithm>
+#include <execution>
+#include <future>
+#include <numeric>
+#include <utility>
+
+// the project is built for x64 only, so SSE is always there.
+// the scalar version below is just a fallback for other compilers/architectures
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define MG_BVH_SSE 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	constexpr int BinCount = 8;		 // number of bins per axis for the SAH split search
+	constexpr int MaxLeafSize = 2;
+	constexpr int StackSize = 128;
+	constexpr uint32_t InvalidNode = ~0u;
+
+	// nodes with fewer primitives are built on the thread that created them,
+	// starting a task costs more than building such a small subtree
+	constexpr uint32_t ParallelBuildThreshold = 4096;
+	constexpr int MaxTaskDepth = 8; // at most 2^8 tasks
+
+	// returns the distance to the box or infinity if the box is missed or further away than hitDist
+	float IntersectAABB(const Ray& ray, const glm::vec3& invDir, const AABB& box, float hitDist)
+	{
+		glm::vec3 t0 = (box.min - ray.Origin) * invDir;
+		glm::vec3 t1 = (box.max - ray.Origin) * invDir;
+		glm::vec3 tSmall = glm::min(t0, t1);
+		glm::vec3 tBig = glm::max(t0, t1);
+
+		float tNear = glm::max(glm::max(tSmall.x, tSmall.y), glm::max(tSmall.z, 0.0f));
+		float tFar = glm::min(glm::min(tBig.x, tBig.y), glm::min(tBig.z, hitDist));
+
+		return (tNear <= tFar) ? tNear : std::numeric_limits<float>::max();
+	}
+
+	// spreads the lower 10 bits of v so there are two zero bits between each of them
+	uint32_t ExpandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// 30 bit morton code of a point inside the unit cube, interleaves the bits of x, y and z
+	uint32_t MortonCode(const glm::vec3& point)
+	{
+		uint32_t x = (uint32_t)glm::clamp(point.x * 1024.0f, 0.0f, 1023.0f);
+		uint32_t y = (uint32_t)glm::clamp(point.y * 1024.0f, 0.0f, 1023.0f);
+		uint32_t z = (uint32_t)glm::clamp(point.z * 1024.0f, 0.0f, 1023.0f);
+		return (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+	}
+
+	int CountLeadingZeros(uint32_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		return _BitScanReverse(&index, v) ? 31 - (int)index : 32;
+#else
+		return v ? __builtin_clz(v) : 32;
+#endif
+	}
+
+	// runs both halves of a build step, as two tasks if the node is big enough
+	template<typename LeftFunc, typename RightFunc>
+	void BuildChildren(bool parallel, LeftFunc&& left, RightFunc&& right)
+	{
+		if (parallel)
+		{
+			std::future<void> leftTask = std::async(std::launch::async, left);
+			right();
+			leftTask.get();
+		}
+		else
+		{
+			left();
+			right();
+		}
+	}
+}
+
+void BVH::Build(const Scene& scene, BuildMethod method)
+{
+	m_SphereCount = (uint32_t)scene.Spheres.size();
+	const uint32_t count = m_SphereCount + (uint32_t)scene.Cubes.size();
+
+	m_Primitives.resize(count);
+	std::iota(m_Primitives.begin(), m_Primitives.end(), 0u);
+	ComputePrimitiveBounds(scene);
+
+	m_Nodes.clear();
+	m_WideNodes.clear();
+	m_Leaves.clear();
+	m_BuildCost = 0.0f;
+	m_BuildMethod = method;
+	if (count == 0)
+		return;
+
+	// a binary tree with n leaves never has more than 2n - 1 nodes.
+	// the tasks take their nodes from this array with an atomic counter
+	m_Nodes.resize(2 * (size_t)count - 1);
+	m_Parents.resize(m_Nodes.size());
+
+	BuildContext context;
+	context.nodeCount = 1;
+	m_Nodes[0].leftFirst = 0;
+	m_Nodes[0].count = count;
+	m_Parents[0] = InvalidNode;
+
+	if (method == BuildMethod::SAH)
+	{
+		UpdateBounds(0);
+		Subdivide(0, 0, context);
+	}
+	else
+	{
+		AABB centroidBounds = std::transform_reduce(std::execution::par, m_Centroids.begin(), m_Centroids.end(), AABB(),
+			[](AABB a, const AABB& b) { a.Grow(b); return a; },
+			[](const glm::vec3& centroid) { return AABB{ centroid, centroid }; });
+		glm::vec3 extent = glm::max(centroidBounds.max - centroidBounds.min, glm::vec3(1e-6f));
+
+		// code in the upper 32 bits and primitive number in the lower ones, so sorting the
+		// keys sorts the primitives along the curve and equal codes stay in a fixed order
+		std::vector<uint64_t> keys(count);
+		std::for_each(std::execution::par, m_Primitives.begin(), m_Primitives.end(),
+			[&](uint32_t primitive) {
+				uint32_t code = MortonCode((m_Centroids[primitive] - centroidBounds.min) / extent);
+				keys[primitive] = ((uint64_t)code << 32) | primitive;
+			});
+		std::sort(std::execution::par, keys.begin(), keys.end());
+
+		context.mortonCodes.resize(count);
+		std::for_each(std::execution::par, m_Primitives.begin(), m_Primitives.end(),
+			[&](uint32_t& primitive) {
+				size_t i = &primitive - m_Primitives.data();
+				primitive = (uint32_t)keys[i];
+				context.mortonCodes[i] = (uint32_t)(keys[i] >> 32);
+			});
+
+		SplitMorton(0, 0, context);
+	}
+
+	m_Nodes.resize(context.nodeCount);
+	m_Parents.resize(context.nodeCount);
+	for (uint32_t i = 0; i < (uint32_t)m_Nodes.size(); i++)
+	{
+		if (m_Nodes[i].count > 0)
+			m_Leaves.push_back(i);
+	}
+	m_RefitVisits.reset(new std::atomic<uint32_t>[m_Nodes.size()]);
+
+	// the morton splits do not look at the boxes, so they are all computed afterwards in one go
+	if (method == BuildMethod::Morton)
+		RefitNodes();
+
+	m_WideNodes.reserve(m_Nodes.size() / 2 + 1);
+	Collapse(0);
+
+	m_BuildCost = GetCost();
+}
+
+void BVH::Refit(const Scene& scene)
+{
+	if (m_Nodes.empty())
+		return;
+
+	ComputePrimitiveBounds(scene);
+	RefitNodes();
+
+	// every wide node just copies the boxes of the binary nodes it was collapsed from
+	std::for_each(std::execution::par, m_WideNodes.begin(), m_WideNodes.end(),
+		[this](WideNode& wide) {
+			for (uint32_t i = 0; i < wide.childCount; i++)
+			{
+				const AABB& bounds = m_Nodes[wide.source[i]].bounds;
+				wide.minX[i] = bounds.min.x; wide.minY[i] = bounds.min.y; wide.minZ[i] = bounds.min.z;
+				wide.maxX[i] = bounds.max.x; wide.maxY[i] = bounds.max.y; wide.maxZ[i] = bounds.max.z;
+			}
+		});
+}
+
+size_t BVH::GetMemorySize() const
+{
+	return m_Nodes.capacity() * sizeof(Node)
+		+ m_WideNodes.capacity() * sizeof(WideNode)
+		+ (m_Parents.capacity() + m_Leaves.capacity() + m_Primitives.capacity()) * sizeof(uint32_t)
+		+ (m_RefitVisits ? m_Nodes.size() * sizeof(std::atomic<uint32_t>) : 0)
+		+ m_PrimitiveBounds.capacity() * sizeof(AABB)
+		+ m_Centroids.capacity() * sizeof(glm::vec3);
+}
+
+size_t BVH::GetWideMemorySize() const
+{
+	// Build reserves half as many wide nodes as there are binary ones
+	if (!m_WideNodes.empty())
+		return m_WideNodes.capacity() * sizeof(WideNode);
+	return m_Nodes.empty() ? 0 : (m_Nodes.size() / 2 + 1) * sizeof(WideNode);
+}
+
+void BVH::ReleaseWideNodes()
+{
+	std::vector<WideNode>().swap(m_WideNodes);
+}
+
+float BVH::GetCost() const
+{
+	if (m_Nodes.empty())
+		return 0.0f;
+
+	// every traversal step and every primitive test counts as 1,
+	// weighted by the probability of a ray hitting the node (its area)
+	float cost = std::transform_reduce(std::execution::par, m_Nodes.begin(), m_Nodes.end(), 0.0f, std::plus<float>(),
+		[](const Node& node) {
+			return node.bounds.Area() * (node.count > 0 ? (float)node.count : 1.0f);
+		});
+	return cost / glm::max(m_Nodes[0].bounds.Area(), 1e-12f);
+}
+
+void BVH::ComputePrimitiveBounds(const Scene& scene)
+{
+	m_PrimitiveBounds.resize(m_Primitives.size());
+	m_Centroids.resize(m_Primitives.size());
+
+	std::for_each(std::execution::par, m_Primitives.begin(), m_Primitives.end(),
+		[&](uint32_t primitive) {
+			AABB& bounds = m_PrimitiveBounds[primitive];
+			if (primitive < m_SphereCount)
+			{
+				const Sphere& sphere = scene.Spheres[primitive];
+				bounds.min = sphere.Position - glm::vec3(sphere.radius);
+				bounds.max = sphere.Position + glm::vec3(sphere.radius);
+			}
+			else
+			{
+				const Cube& cube = scene.Cubes[primitive - m_SphereCount];
+				bounds.min = cube.min;
+				bounds.max = cube.max;
+			}
+			m_Centroids[primitive] = bounds.Center();
+		});
+}
+
+void BVH::RefitNodes()
+{
+	for (uint32_t i = 0; i < (uint32_t)m_Nodes.size(); i++)
+	{
+		m_RefitVisits[i].store(0, std::memory_order_relaxed);
+	}
+
+	// every leaf walks up towards the root. the first child arriving at a node stops there,
+	// the second one knows both boxes are done, merges them and carries on upwards
+	std::for_each(std::execution::par, m_Leaves.begin(), m_Leaves.end(),
+		[this](uint32_t leaf) {
+			UpdateBounds(leaf);
+			uint32_t node = m_Parents[leaf];
+			while (node != InvalidNode)
+			{
+				if (m_RefitVisits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+					return;
+
+				AABB bounds = m_Nodes[m_Nodes[node].leftFirst].bounds;
+				bounds.Grow(m_Nodes[m_Nodes[node].leftFirst + 1].bounds);
+				m_Nodes[node].bounds = bounds;
+				node = m_Parents[node];
+			}
+		});
+}
+
+void BVH::UpdateBounds(uint32_t nodeIndex)
+{
+	Node& node = m_Nodes[nodeIndex];
+	node.bounds = AABB();
+	for (uint32_t i = 0; i < node.count; i++)
+	{
+		node.bounds.Grow(m_PrimitiveBounds[m_Primitives[node.leftFirst + i]]);
+	}
+}
+
+uint32_t BVH::AllocateChildren(uint32_t parent, uint32_t leftFirst, uint32_t leftCount, uint32_t rightFirst, uint32_t rightCount, BuildContext& context)
+{
+	uint32_t leftChild = context.nodeCount.fetch_add(2);
+	m_Nodes[leftChild].leftFirst = leftFirst;
+	m_Nodes[leftChild].count = leftCount;
+	m_Nodes[leftChild + 1].leftFirst = rightFirst;
+	m_Nodes[leftChild + 1].count = rightCount;
+	m_Parents[leftChild] = parent;
+	m_Parents[leftChild + 1] = parent;
+
+	m_Nodes[parent].leftFirst = leftChild;
+	m_Nodes[parent].count = 0;
+	return leftChild;
+}
+
+void BVH::Subdivide(uint32_t nodeIndex, int depth, BuildContext& context)
+{
+	const uint32_t first = m_Nodes[nodeIndex].leftFirst;
+	const uint32_t count = m_Nodes[nodeIndex].count;
+	if (count <= MaxLeafSize)
+		return;
+	// the bins are placed over the bounds of the centroids, not of the primitives
+	AABB centroidBounds;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		centroidBounds.Grow(m_Centroids[m_Primitives[first + i]]);
+	}
+
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float bestCost = std::numeric_limits<float>::max();
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float lo = centroidBounds.min[axis];
+		float hi = centroidBounds.max[axis];
+		if (lo == hi)
+			continue;
+
+		struct Bin { AABB bounds; uint32_t count = 0; } bins[BinCount];
+		float scale = (float)BinCount / (hi - lo);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t primitive = m_Primitives[first + i];
+			int bin = std::min(BinCount - 1, (int)((m_Centroids[primitive][axis] - lo) * scale));
+			bins[bin].count++;
+			bins[bin].bounds.Grow(m_PrimitiveBounds[primitive]);
+		}
+
+		// sweep once from the left and once from the right to get the cost of every split plane
+		float leftArea[BinCount - 1], rightArea[BinCount - 1];
+		uint32_t leftCount[BinCount - 1], rightCount[BinCount - 1];
+		AABB leftBox, rightBox;
+		uint32_t leftSum = 0, rightSum = 0;
+		for (int i = 0; i < BinCount - 1; i++)
+		{
+			leftSum += bins[i].count;
+			leftBox.Grow(bins[i].bounds);
+			leftCount[i] = leftSum;
+			leftArea[i] = leftSum > 0 ? leftBox.Area() : 0.0f;
+
+			rightSum += bins[BinCount - 1 - i].count;
+			rightBox.Grow(bins[BinCount - 1 - i].bounds);
+			rightCount[BinCount - 2 - i] = rightSum;
+			rightArea[BinCount - 2 - i] = rightSum > 0 ? rightBox.Area() : 0.0f;
+		}
+
+		for (int i = 0; i < BinCount - 1; i++)
+		{
+			float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (leftCount[i] > 0 && rightCount[i] > 0 && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	// stop when splitting is not cheaper than testing every primitive of this node
+	if (bestAxis < 0 || bestCost >= count * m_Nodes[nodeIndex].bounds.Area())
+		return;
+
+	// partition the primitive range in place, everything up to the split bin goes left
+	float lo = centroidBounds.min[bestAxis];
+	float scale = (float)BinCount / (centroidBounds.max[bestAxis] - lo);
+	uint32_t i = first;
+	uint32_t j = first + count - 1;
+	while (i <= j)
+	{
+		int bin = std::min(BinCount - 1, (int)((m_Centroids[m_Primitives[i]][bestAxis] - lo) * scale));
+		if (bin <= bestSplit)
+		{
+			i++;
+		}
+		else
+		{
+			std::swap(m_Primitives[i], m_Primitives[j]);
+			if (j == 0)
+				break;
+			j--;
+		}
+	}
+
+	uint32_t leftCount = i - first;
+	if (leftCount == 0 || leftCount == count)
+		return;
+
+	uint32_t leftChild = AllocateChildren(nodeIndex, first, leftCount, i, count - leftCount, context);
+	UpdateBounds(leftChild);
+	UpdateBounds(leftChild + 1);
+
+	BuildChildren(count >= ParallelBuildThreshold && depth < MaxTaskDepth,
+		[this, leftChild, depth, &context]() { Subdivide(leftChild, depth + 1, context); },
+		[this, leftChild, depth, &context]() { Subdivide(leftChild + 1, depth + 1, context); });
+}
+
+void BVH::SplitMorton(uint32_t nodeIndex, int depth, BuildContext& context)
+{
+	const uint32_t first = m_Nodes[nodeIndex].leftFirst;
+	const uint32_t count = m_Nodes[nodeIndex].count;
+	if (count <= MaxLeafSize)
+		return;
+
+	const uint32_t last = first + count - 1;
+	const uint32_t firstCode = context.mortonCodes[first];
+	const uint32_t lastCode = context.mortonCodes[last];
+
+	// split where the highest bit that differs inside the range flips from 0 to 1.
+	// identical codes have no such bit, then the range is just halved
+	uint32_t split = first + count / 2 - 1;
+	if (firstCode != lastCode)
+	{
+		int commonPrefix = CountLeadingZeros(firstCode ^ lastCode);
+
+		// binary search for the last primitive that still shares more bits with the first one
+		split = first;
+		uint32_t step = last - first;
+		do
+		{
+			step = (step + 1) >> 1;
+			uint32_t newSplit = split + step;
+			if (newSplit < last && CountLeadingZeros(firstCode ^ context.mortonCodes[newSplit]) > commonPrefix)
+				split = newSplit;
+		} while (step > 1);
+	}
+
+	uint32_t leftCount = split - first + 1;
+	uint32_t leftChild = AllocateChildren(nodeIndex, first, leftCount, split + 1, count - leftCount, context);
+
+	BuildChildren(count >= ParallelBuildThreshold && depth < MaxTaskDepth,
+		[this, leftChild, depth, &context]() { SplitMorton(leftChild, depth + 1, context); },
+		[this, leftChild, depth, &context]() { SplitMorton(leftChild + 1, depth + 1, context); });
+}
+
+uint32_t BVH::Collapse(uint32_t nodeIndex)
+{
+	uint32_t children[4];
+	uint32_t childCount = 0;
+
+	if (m_Nodes[nodeIndex].count > 0)
+	{
+		// only happens for a root which is a leaf already
+		children[childCount++] = nodeIndex;
+	}
+	else
+	{
+		children[childCount++] = m_Nodes[nodeIndex].leftFirst;
+		children[childCount++] = m_Nodes[nodeIndex].leftFirst + 1;
+	}
+
+	// pull the grandchildren up: open the biggest inner child until there are four
+	while (childCount < 4)
+	{
+		int biggest = -1;
+		float biggestArea = -1.0f;
+		for (uint32_t i = 0; i < childCount; i++)
+		{
+			const Node& child = m_Nodes[children[i]];
+			if (child.count == 0 && child.bounds.Area() > biggestArea)
+			{
+				biggest = (int)i;
+				biggestArea = child.bounds.Area();
+			}
+		}
+		if (biggest < 0)
+			break;
+
+		uint32_t opened = children[biggest];
+		children[biggest] = m_Nodes[opened].leftFirst;
+		children[childCount++] = m_Nodes[opened].leftFirst + 1;
+	}
+
+	uint32_t wideIndex = (uint32_t)m_WideNodes.size();
+	m_WideNodes.emplace_back();
+	{
+		WideNode& wide = m_WideNodes[wideIndex];
+		wide.childCount = childCount;
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			// unused slots get a valid empty box, they are masked out during traversal anyway
+			const AABB bounds = (i < childCount) ? m_Nodes[children[i]].bounds : AABB{ glm::vec3(0.0f), glm::vec3(0.0f) };
+			wide.minX[i] = bounds.min.x; wide.minY[i] = bounds.min.y; wide.minZ[i] = bounds.min.z;
+			wide.maxX[i] = bounds.max.x; wide.maxY[i] = bounds.max.y; wide.maxZ[i] = bounds.max.z;
+			wide.child[i] = (i < childCount) ? m_Nodes[children[i]].leftFirst : 0;
+			wide.count[i] = (i < childCount) ? m_Nodes[children[i]].count : 0;
+			wide.source[i] = (i < childCount) ? children[i] : 0;
+		}
+	}
+
+	// recursing adds nodes to m_WideNodes, so there is no reference kept over these calls
+	for (uint32_t i = 0; i < childCount; i++)
+	{
+		if (m_Nodes[children[i]].count == 0)
+		{
+			uint32_t childWide = Collapse(children[i]);
+			m_WideNodes[wideIndex].child[i] = childWide;
+		}
+	}
+
+	return wideIndex;
+}
+
+float BVH::IntersectPrimitive(const Ray& ray, const Scene& scene, uint32_t primitive) const
+{
+	if (primitive < m_SphereCount)
+		return Intersection::Sphere(ray, scene.Spheres[primitive]);
+	return Intersection::Cube(ray, scene.Cubes[primitive - m_SphereCount]);
+}
+
+bool BVH::IntersectBinary(const Ray& ray, const Scene& scene, float& hitDist, uint32_t& primitive) const
+{
+	hitDist = std::numeric_limits<float>::max();
+	if (m_Nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / ray.Direction;
+	if (IntersectAABB(ray, invDir, m_Nodes[0].bounds, hitDist) == std::numeric_limits<float>::max())
+		return false;
+
+	bool hit = false;
+	uint32_t stack[StackSize];
+	int stackPtr = 0;
+	uint32_t nodeIndex = 0;
+
+	while (true)
+	{
+		const Node& node = m_Nodes[nodeIndex];
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				uint32_t candidate = m_Primitives[node.leftFirst + i];
+				float t = IntersectPrimitive(ray, scene, candidate);
+				if (t > 0.0f && t < hitDist)
+				{
+					hitDist = t;
+					primitive = candidate;
+					hit = true;
+				}
+			}
+			if (stackPtr == 0)
+				break;
+			nodeIndex = stack[--stackPtr];
+			continue;
+		}
+
+		// visit the closer child first, the other one is put on the stack
+		uint32_t near = node.leftFirst;
+		uint32_t far = node.leftFirst + 1;
+		float nearDist = IntersectAABB(ray, invDir, m_Nodes[near].bounds, hitDist);
+		float farDist = IntersectAABB(ray, invDir, m_Nodes[far].bounds, hitDist);
+		if (nearDist > farDist)
+		{
+			std::swap(near, far);
+			std::swap(nearDist, farDist);
+		}
+
+		if (nearDist == std::numeric_limits<float>::max())
+		{
+			if (stackPtr == 0)
+				break;
+			nodeIndex = stack[--stackPtr];
+		}
+		else
+		{
+			nodeIndex = near;
+			if (farDist != std::numeric_limits<float>::max())
+				stack[stackPtr++] = far;
+		}
+	}
+
+	return hit;
+}
+
+bool BVH::IntersectWide(const Ray& ray, const Scene& scene, float& hitDist, uint32_t& primitive) const
+{
+	hitDist = std::numeric_limits<float>::max();
+	if (m_WideNodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.0f / ray.Direction;
+#ifdef MG_BVH_SSE
+	const __m128 originX = _mm_set1_ps(ray.Origin.x), originY = _mm_set1_ps(ray.Origin.y), originZ = _mm_set1_ps(ray.Origin.z);
+	const __m128 invDirX = _mm_set1_ps(invDir.x), invDirY = _mm_set1_ps(invDir.y), invDirZ = _mm_set1_ps(invDir.z);
+#endif
+
+	struct StackEntry { uint32_t node; float tNear; };
+	StackEntry stack[StackSize];
+	int stackPtr = 0;
+	stack[stackPtr++] = { 0, 0.0f };
+
+	bool hit = false;
+	while (stackPtr > 0)
+	{
+		const StackEntry entry = stack[--stackPtr];
+		if (entry.tNear >= hitDist) // a closer hit was found since this node was pushed
+			continue;
+
+		const WideNode& node = m_WideNodes[entry.node];
+
+		alignas(16) float tNear[4];
+		int mask = 0;
+#ifdef MG_BVH_SSE
+		// slab test of the ray against all four child boxes at once
+		__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), invDirX);
+		__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), invDirX);
+		__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), invDirY);
+		__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), invDirY);
+		__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), invDirZ);
+		__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), invDirZ);
+
+		__m128 tMin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+		__m128 tMax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(hitDist)));
+
+		mask = _mm_movemask_ps(_mm_cmple_ps(tMin, tMax));
+		_mm_store_ps(tNear, tMin);
+#else
+		for (int lane = 0; lane < 4; lane++)
+		{
+			AABB box{ { node.minX[lane], node.minY[lane], node.minZ[lane] }, { node.maxX[lane], node.maxY[lane], node.maxZ[lane] } };
+			tNear[lane] = IntersectAABB(ray, invDir, box, hitDist);
+			if (tNear[lane] != std::numeric_limits<float>::max())
+				mask |= 1 << lane;
+		}
+#endif
+		mask &= (1 << node.childCount) - 1;
+		if (mask == 0)
+			continue;
+
+		// sort the hit children by distance (insertion sort, there are at most four)
+		int order[4];
+		int hitCount = 0;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+			int pos = hitCount++;
+			while (pos > 0 && tNear[order[pos - 1]] > tNear[lane])
+			{
+				order[pos] = order[pos - 1];
+				pos--;
+			}
+			order[pos] = lane;
+		}
+
+		// leaves are tested right away, nearest first so hitDist shrinks as early as possible
+		for (int i = 0; i < hitCount; i++)
+		{
+			int lane = order[i];
+			if (node.count[lane] == 0 || tNear[lane] >= hitDist)
+				continue;
+			for (uint32_t p = 0; p < node.count[lane]; p++)
+			{
+				uint32_t candidate = m_Primitives[node.child[lane] + p];
+				float t = IntersectPrimitive(ray, scene, candidate);
+				if (t > 0.0f && t < hitDist)
+				{
+					hitDist = t;
+					primitive = candidate;
+					hit = true;
+				}
+			}
+		}
+
+		// inner children are pushed farthest first, so the nearest one is popped next
+		for (int i = hitCount - 1; i >= 0; i--)
+		{
+			int lane = order[i];
+			if (node.count[lane] == 0)
+				stack[stackPtr++] = { node.child[lane], tNear[lane] };
+		}
+	}
+
+	return hit;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Ray.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+struct AABB
+{
+	glm::vec3 min{ std::numeric_limits<float>::max() };
+	glm::vec3 max{ -std::numeric_limits<float>::max() };
+
+	void Grow(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void Grow(const AABB& other)
+	{
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	float Area() const
+	{
+		glm::vec3 extent = max - min;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	glm::vec3 Center() const
+	{
+		return (min + max) * 0.5f;
+	}
+};
+
+// bounding volume hierarchy over all spheres and cubes of a scene.
+// the primitives are numbered as one list: first all spheres, then all cubes (the order of PrimitiveTable).
+//
+// the tree is built as a binary tree using the surface area heuristic (SAH) and then
+// collapsed into a wide tree with four children per node. the wide nodes store the
+// child boxes as structure of arrays so one SSE slab test checks all four of them,
+// this pays off most for the incoherent rays after the first diffuse bounce
+//
+// for animated scenes the tree does not have to be rebuilt every frame: Refit() keeps the
+// topology and only recomputes the boxes bottom up. this gets slower to trace the further
+// the primitives move, GetCost() compared to GetBuildCost() tells how much worse it got
+class BVH
+{
+public:
+	enum class BuildMethod
+	{
+		SAH = 0,	// binned surface area heuristic, best trees but slower to build
+		Morton		// primitives sorted along a morton curve and split at its bits (LBVH), very fast to build
+	};
+
+	// both build methods split the work into parallel tasks for the upper levels of the tree
+	void Build(const Scene& scene, BuildMethod method = BuildMethod::SAH);
+
+	// recomputes all boxes for moved primitives, the number of primitives has to stay the same
+	void Refit(const Scene& scene);
+
+	// SAH cost of the current tree, relative to the area of the root
+	float GetCost() const;
+	float GetBuildCost() const { return m_BuildCost; }
+	BuildMethod GetBuildMethod() const { return m_BuildMethod; }
+
+	// both return the closest primitive in front of the ray, false if nothing was hit
+	bool IntersectBinary(const Ray& ray, const Scene& scene, float& hitDist, uint32_t& primitive) const;
+	bool IntersectWide(const Ray& ray, const Scene& scene, float& hitDist, uint32_t& primitive) const;
+
+	size_t GetBinaryNodeCount() const { return m_Nodes.size(); }
+	size_t GetWideNodeCount() const { return m_WideNodes.size(); }
+
+	// bytes of all arrays, including the build and refit data
+	size_t GetMemorySize() const;
+	// bytes the wide nodes take, or would take after the next build if they were released
+	size_t GetWideMemorySize() const;
+
+	// frees the wide nodes to save memory, IntersectWide finds nothing until the next Build
+	void ReleaseWideNodes();
+	bool HasWideNodes() const { return !m_WideNodes.empty(); }
+private:
+	struct Node
+	{
+		AABB bounds;
+		uint32_t leftFirst = 0;	// inner node: index of the left child (right one follows), leaf: first primitive
+		uint32_t count = 0;		// number of primitives, 0 for inner nodes
+	};
+
+	struct alignas(16) WideNode
+	{
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4];	// inner child: index of the wide node, leaf: first primitive
+		uint32_t count[4];	// number of primitives of a leaf, 0 for inner children
+		uint32_t source[4];	// the binary node every child was taken from, needed for refitting
+		uint32_t childCount;
+	};
+
+	// state shared by all build tasks
+	struct BuildContext
+	{
+		std::atomic<uint32_t> nodeCount{ 0 };
+		std::vector<uint32_t> mortonCodes; // only used by BuildMethod::Morton, sorted like m_Primitives
+	};
+
+	void ComputePrimitiveBounds(const Scene& scene);
+	uint32_t AllocateChildren(uint32_t parent, uint32_t leftFirst, uint32_t leftCount, uint32_t rightFirst, uint32_t rightCount, BuildContext& context);
+
+	void Subdivide(uint32_t nodeIndex, int depth, BuildContext& context);
+	void SplitMorton(uint32_t nodeIndex, int depth, BuildContext& context);
+	void RefitNodes();
+	void UpdateBounds(uint32_t nodeIndex);
+	uint32_t Collapse(uint32_t nodeIndex);
+
+	float IntersectPrimitive(const Ray& ray, const Scene& scene, uint32_t primitive) const;
+private:
+	std::vector<Node> m_Nodes;
+	std::vector<WideNode> m_WideNodes;
+
+	std::vector<uint32_t> m_Parents;	// parent of every binary node, the root has InvalidNode
+	std::vector<uint32_t> m_Leaves;		// all leaf nodes, refitting starts at these
+	std::unique_ptr<std::atomic<uint32_t>[]> m_RefitVisits; // how many children of a node are refitted already
+	float m_BuildCost = 0.0f;
+	BuildMethod m_BuildMethod = BuildMethod::SAH; // of the last Build, GetBuildCost belongs to it
+
+	std::vector<uint32_t> m_Primitives;	// primitive numbers, sorted so every leaf is one range
+	std::vector<AABB> m_PrimitiveBounds;
+	std::vector<glm::vec3> m_Centroids;
+	uint32_t m_SphereCount = 0;
+};
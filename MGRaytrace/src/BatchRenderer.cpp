@@ -0,0 +1,219 @@
+#include "BatchRenderer.h"
+
+#include "Camera.h"
+#include "Renderer.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <execution>
+#include <numeric>
+#include <thread>
+
+#ifdef WL_PLATFORM_WINDOWS
+#define popen _popen
+#define pclose _pclose
+// binary mode, otherwise windows turns every 0x0A byte of the pixels into 0x0D 0x0A
+static const char* PipeMode = "wb";
+#else
+static const char* PipeMode = "w";
+#endif
+
+BatchRenderer::BatchRenderer(const Scene& scene, const CameraPath& path, const BatchSettings& settings)
+	: m_Scene(scene), m_Path(path), m_Settings(settings)
+{
+}
+
+bool BatchRenderer::Run(std::string& error)
+{
+	if (!m_Settings.pipeCommand.empty())
+	{
+		m_Pipe = popen(m_Settings.pipeCommand.c_str(), PipeMode);
+		if (!m_Pipe)
+		{
+			error = "could not start " + m_Settings.pipeCommand;
+			return false;
+		}
+	}
+
+	Renderer renderer(true);
+	renderer.GetSettings().NumaPinning = m_Settings.numaPinning;
+	renderer.GetSettings().MemoryBudgetMB = m_Settings.memoryBudgetMB;
+	renderer.GetSettings().SamplesPerFrame = std::max(m_Settings.samplesPerFrame, 1u);
+	// the command line only allows a samplesPerPixel divisible by samplesPerFrame
+	uint32_t rendersPerFrame = std::max(m_Settings.samplesPerPixel / renderer.GetSettings().SamplesPerFrame, 1u);
+	renderer.onResize(m_Settings.width, m_Settings.height);
+
+	Camera camera(45.0f, 0.1f, 100.0f);
+	camera.OnResize(m_Settings.width, m_Settings.height);
+
+	m_TracingDone = false;
+	m_WriteError.clear();
+	std::thread writer(&BatchRenderer::WriterLoop, this);
+
+	size_t pixelCount = (size_t)m_Settings.width * m_Settings.height;
+	Walnut::Timer totalTimer;
+
+	for (uint32_t frame = 0; frame < m_Settings.frames; frame++)
+	{
+		// the frames divide a closed path like the turntable evenly without the end point, so it loops
+		// without showing the same frame twice. an open path ends on its last keyframe
+		float time = 0.0f;
+		if (m_Path.IsClosed())
+			time = m_Path.GetDuration() * (float)frame / (float)m_Settings.frames;
+		else if (m_Settings.frames > 1)
+			time = m_Path.GetDuration() * (float)frame / (float)(m_Settings.frames - 1);
+		glm::vec3 position, forward;
+		m_Path.Evaluate(time, position, forward);
+		camera.SetRayDirectionCache(renderer.WantsRayDirectionCache());
+		camera.SetView(position, forward);
+
+		Walnut::Timer frameTimer;
+		renderer.FrameCountReset();
+		for (uint32_t render = 0; render < rendersPerFrame; render++)
+		{
+			renderer.Render(m_Scene, camera);
+		}
+		float traceMs = frameTimer.ElapsedMillis();
+
+		FrameJob job;
+		job.index = frame;
+		job.samples = renderer.GetAccumulatedFrames();
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			// wait until the writer caught up, this keeps the memory bounded if the disk is slow
+			m_QueueChanged.wait(lock, [this] { return m_Queue.size() < MaxQueuedFrames || !m_WriteError.empty(); });
+			if (!m_WriteError.empty())
+				break;
+
+			if (!m_FreeBuffers.empty())
+			{
+				job.accumulation = std::move(m_FreeBuffers.back());
+				m_FreeBuffers.pop_back();
+			}
+		}
+
+		const glm::vec4* accumulation = renderer.GetAccumulationData();
+		job.accumulation.assign(accumulation, accumulation + pixelCount);
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Queue.push_back(std::move(job));
+		}
+		m_QueueChanged.notify_all();
+
+		printf("frame %u/%u traced in %.1f ms\n", frame + 1, m_Settings.frames, traceMs);
+		for (const NumaThreadPool::NodeStatistics& node : renderer.GetNodeStatistics())
+		{
+			printf("  node %u: %u threads, %u rows, %.1f Mpixel/s\n", node.node, node.threads, node.rows,
+				node.milliseconds > 0.0f ? (float)node.rows * m_Settings.width / (node.milliseconds * 1000.0f) : 0.0f);
+		}
+	}
+
+	const Renderer::MemoryUsage& memory = renderer.GetMemoryUsage();
+	printf("renderer memory: %.1f MB (framebuffers %.1f, ray cache %.1f, scene %.1f, acceleration %.1f)%s\n",
+		memory.Total() / 1048576.0, memory.framebuffers / 1048576.0, memory.rayCache / 1048576.0,
+		memory.scene / 1048576.0, memory.acceleration / 1048576.0, memory.overBudget ? ", over the budget" : "");
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_TracingDone = true;
+	}
+	m_QueueChanged.notify_all();
+	writer.join();
+
+	if (m_Pipe)
+	{
+		pclose(m_Pipe);
+		m_Pipe = nullptr;
+	}
+
+	if (!m_WriteError.empty())
+	{
+		error = m_WriteError;
+		return false;
+	}
+
+	printf("rendered %u frames in %.1f s\n", m_Settings.frames, totalTimer.Elapsed());
+	return true;
+}
+
+void BatchRenderer::WriterLoop()
+{
+	std::vector<uint8_t> encoded;
+
+	while (true)
+	{
+		FrameJob job;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_QueueChanged.wait(lock, [this] { return !m_Queue.empty() || m_TracingDone; });
+			if (m_Queue.empty())
+				return;
+
+			job = std::move(m_Queue.front());
+			m_Queue.pop_front();
+		}
+
+		// the frames come in order, so the pipe gets them in the right order as well
+		bool written = WriteFrame(job, encoded);
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_FreeBuffers.push_back(std::move(job.accumulation));
+			if (!written)
+			{
+				m_WriteError = "could not write frame " + std::to_string(job.index);
+				m_Queue.clear();
+			}
+		}
+		m_QueueChanged.notify_all();
+
+		if (!written)
+			return;
+	}
+}
+
+bool BatchRenderer::WriteFrame(const FrameJob& job, std::vector<uint8_t>& encoded)
+{
+	uint32_t width = m_Settings.width;
+	uint32_t height = m_Settings.height;
+
+	// binary PPM: a small text header followed by the RGB bytes, top row first
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+	encoded.resize(headerSize + (size_t)width * height * 3);
+	memcpy(encoded.data(), header, headerSize);
+
+	// resolve the average of all samples, every row on its own thread
+	std::vector<uint32_t> rows(height);
+	std::iota(rows.begin(), rows.end(), 0);
+	float invSamples = 1.0f / (float)std::max(job.samples, 1u);
+	uint8_t* pixels = encoded.data() + headerSize;
+
+	std::for_each(std::execution::par, rows.begin(), rows.end(),
+		[&](uint32_t y) {
+			// the renderer starts with the bottom row
+			uint8_t* row = pixels + (size_t)(height - 1 - y) * width * 3;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				glm::vec4 color = glm::clamp(job.accumulation[x + y * width] * invSamples, glm::vec4(0.0f), glm::vec4(1.0f));
+				row[x * 3 + 0] = (uint8_t)(color.r * 255.0f);
+				row[x * 3 + 1] = (uint8_t)(color.g * 255.0f);
+				row[x * 3 + 2] = (uint8_t)(color.b * 255.0f);
+			}
+		});
+
+	if (m_Pipe)
+		return fwrite(encoded.data(), 1, encoded.size(), m_Pipe) == encoded.size();
+
+	char path[1024];
+	snprintf(path, sizeof(path), m_Settings.outputPattern.c_str(), job.index); // checked by the command line
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	bool written = fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+	return fclose(file) == 0 && written;
+}
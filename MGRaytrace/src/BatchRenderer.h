@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CameraPath.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct BatchSettings
+{
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t frames = 60;
+	uint32_t samplesPerPixel = 64;
+	uint32_t samplesPerFrame = 1;					// see Renderer::Settings::SamplesPerFrame, fewer resolves for the same spp, has to divide it
+	std::string outputPattern = "frame_%04d.ppm";	// printf pattern with exactly one %d for the frame number
+	std::string pipeCommand;						// if set, all frames are written as one PPM stream into this command instead
+	bool numaPinning = false;						// see Renderer::Settings::NumaPinning
+	uint32_t memoryBudgetMB = 0;					// see Renderer::Settings::MemoryBudgetMB
+};
+
+// renders a camera path frame by frame without a window.
+//
+// the work is split into two stages which run at the same time: the calling thread traces
+// frame N+1 while a writer thread resolves, encodes and writes frame N. both stages spread
+// their pixels over all cores, so a slow disk or encoder only costs time when the writer
+// falls more than MaxQueuedFrames behind
+class BatchRenderer
+{
+public:
+	BatchRenderer(const Scene& scene, const CameraPath& path, const BatchSettings& settings);
+
+	// renders all frames, returns false if writing one of them failed
+	bool Run(std::string& error);
+private:
+	struct FrameJob
+	{
+		uint32_t index = 0;
+		uint32_t samples = 0;
+		std::vector<glm::vec4> accumulation;
+	};
+
+	void WriterLoop();
+	bool WriteFrame(const FrameJob& job, std::vector<uint8_t>& encoded);
+private:
+	static constexpr size_t MaxQueuedFrames = 2;
+
+	const Scene& m_Scene;
+	const CameraPath& m_Path;
+	BatchSettings m_Settings;
+
+	FILE* m_Pipe = nullptr;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_QueueChanged;
+	std::deque<FrameJob> m_Queue;
+	std::vector<std::vector<glm::vec4>> m_FreeBuffers; // accumulation copies the writer is done with
+	bool m_TracingDone = false;
+	std::string m_WriteError;
+};
@@ -14,6 +14,9 @@ public:
 	bool OnUpdate(float ts);
 	void OnResize(uint32_t width, uint32_t height);
 
+	// places the camera directly, used for scripted camera paths instead of the mouse and keyboard
+	void SetView(const glm::vec3& position, const glm::vec3& forwardDirection);
+
 	const glm::mat4& GetProjection() const { return m_Projection; }
 	const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
 	const glm::mat4& GetView() const { return m_View; }
@@ -24,11 +27,27 @@ public:
 
 	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
 
+	// the direction of the ray through pixel x, y. taken from the cache if there is one, otherwise
+	// computed the same way (one matrix multiplication more per primary ray)
+	glm::vec3 GetRayDirection(uint32_t x, uint32_t y) const
+	{
+		return m_RayDirections.empty() ? ComputeRayDirection((float)x, (float)y) : m_RayDirections[x + y * m_ViewportWidth];
+	}
+
+	// the same for any point of the image, e.g. jittered inside the pixel. never cached
+	glm::vec3 GetRayDirection(const glm::vec2& pixel) const { return ComputeRayDirection(pixel.x, pixel.y); }
+
+	// the cache costs 12 bytes per pixel, without it GetRayDirections() is empty
+	void SetRayDirectionCache(bool enabled);
+	bool HasRayDirectionCache() const { return m_CacheRayDirections; }
+	size_t GetMemorySize() const { return m_RayDirections.capacity() * sizeof(glm::vec3); }
+
 	float GetRotationSpeed();
 private:
 	void RecalculateProjection();
 	void RecalculateView();
 	void RecalculateRayDirections();
+	glm::vec3 ComputeRayDirection(float x, float y) const;
 private:
 	glm::mat4 m_Projection{ 1.0f };
 	glm::mat4 m_View{ 1.0f };
@@ -44,6 +63,7 @@ private:
 
 	// Cached ray directions
 	std::vector<glm::vec3> m_RayDirections;
+	bool m_CacheRayDirections = true;
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
@@ -0,0 +1,149 @@
+#include "CameraPath.h"
+
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace {
+	glm::vec3 CatmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t)
+	{
+		float t2 = t * t;
+		float t3 = t2 * t;
+		return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+
+	// spherical interpolation between two directions, so the camera turns with constant speed
+	glm::vec3 Slerp(const glm::vec3& a, const glm::vec3& b, float t)
+	{
+		float cosAngle = glm::clamp(glm::dot(a, b), -1.0f, 1.0f);
+		if (cosAngle > 0.9995f) // nearly the same direction, the linear version is exact enough
+			return glm::normalize(glm::mix(a, b, t));
+
+		float angle = glm::acos(cosAngle);
+		if (cosAngle < -0.9995f)
+		{
+			// nearly opposite, every plane through both is about as good and sin(angle) is close to 0.
+			// the camera turns around the axis closest to up (the one of Camera), so it does not roll over
+			glm::vec3 up(0.0f, 1.0f, 0.0f);
+			glm::vec3 axis = up - glm::dot(up, a) * a;
+			if (glm::dot(axis, axis) < 1e-6f) // looking straight up or down
+				axis = glm::cross(a, glm::vec3(1.0f, 0.0f, 0.0f));
+			axis = glm::normalize(axis);
+			return glm::normalize(glm::cos(t * angle) * a + glm::sin(t * angle) * glm::cross(axis, a));
+		}
+
+		return glm::normalize((glm::sin((1.0f - t) * angle) * a + glm::sin(t * angle) * b) / glm::sin(angle));
+	}
+}
+
+void CameraPath::AddKeyframe(const CameraKeyframe& keyframe)
+{
+	CameraKeyframe normalized = keyframe;
+	normalized.forward = glm::normalize(keyframe.forward);
+
+	auto position = std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), keyframe.time,
+		[](float time, const CameraKeyframe& other) { return time < other.time; });
+	m_Keyframes.insert(position, normalized);
+}
+
+bool CameraPath::LoadFromFile(const std::string& path, std::string& error)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		error = "could not open " + path;
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		std::istringstream stream(line);
+		std::string type;
+		if (!(stream >> type) || type[0] == '#')
+			continue;
+
+		CameraKeyframe keyframe;
+		if (type != "key" || !(stream >> keyframe.time
+			>> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+			>> keyframe.forward.x >> keyframe.forward.y >> keyframe.forward.z))
+		{
+			error = path + ":" + std::to_string(lineNumber) + ": could not read \"" + line + "\"";
+			return false;
+		}
+		AddKeyframe(keyframe);
+	}
+
+	if (m_Keyframes.empty())
+	{
+		error = path + " has no keyframes";
+		return false;
+	}
+	return true;
+}
+
+CameraPath CameraPath::CreateTurntable(const glm::vec3& center, float radius, float height, float duration)
+{
+	// enough keyframes that the spline is practically a circle
+	constexpr int KeyframeCount = 32;
+
+	CameraPath path;
+	for (int i = 0; i <= KeyframeCount; i++)
+	{
+		float angle = glm::two_pi<float>() * (float)i / (float)KeyframeCount;
+
+		CameraKeyframe keyframe;
+		keyframe.time = duration * (float)i / (float)KeyframeCount;
+		keyframe.position = center + glm::vec3(glm::sin(angle) * radius, height, glm::cos(angle) * radius);
+		keyframe.forward = center - keyframe.position;
+		path.AddKeyframe(keyframe);
+	}
+	return path;
+}
+
+bool CameraPath::IsClosed() const
+{
+	if (m_Keyframes.size() < 2)
+		return false;
+
+	const CameraKeyframe& first = m_Keyframes.front();
+	const CameraKeyframe& last = m_Keyframes.back();
+	return glm::distance(first.position, last.position) < 1e-3f && glm::dot(first.forward, last.forward) > 0.9999f;
+}
+
+void CameraPath::Evaluate(float time, glm::vec3& position, glm::vec3& forward) const
+{
+	if (m_Keyframes.empty())
+		return;
+
+	if (time <= m_Keyframes.front().time || m_Keyframes.size() == 1)
+	{
+		position = m_Keyframes.front().position;
+		forward = m_Keyframes.front().forward;
+		return;
+	}
+	if (time >= m_Keyframes.back().time)
+	{
+		position = m_Keyframes.back().position;
+		forward = m_Keyframes.back().forward;
+		return;
+	}
+
+	// the segment between keyframe i and i + 1 contains the time
+	size_t i = std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), time,
+		[](float t, const CameraKeyframe& keyframe) { return t < keyframe.time; }) - m_Keyframes.begin() - 1;
+
+	const CameraKeyframe& from = m_Keyframes[i];
+	const CameraKeyframe& to = m_Keyframes[i + 1];
+	float t = (time - from.time) / glm::max(to.time - from.time, 1e-6f);
+
+	// the curve needs the neighbours, at both ends the outer keyframes are repeated
+	const glm::vec3& before = m_Keyframes[i > 0 ? i - 1 : i].position;
+	const glm::vec3& after = m_Keyframes[i + 2 < m_Keyframes.size() ? i + 2 : i + 1].position;
+
+	position = CatmullRom(before, from.position, to.position, after, t);
+	forward = Slerp(from.forward, to.forward, t);
+}
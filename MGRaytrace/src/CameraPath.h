@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+struct CameraKeyframe
+{
+	float time = 0.0f; // in seconds
+	glm::vec3 position{ 0.0f };
+	glm::vec3 forward{ 0.0f, 0.0f, -1.0f };
+};
+
+// a scripted camera movement made of keyframes.
+// the position follows a smooth curve through all keyframes (catmull-rom),
+// the forward direction is rotated evenly from one keyframe to the next (slerp).
+//
+// the file format has one keyframe per line, # starts a comment:
+//   key <time> <position x y z> <forward x y z>
+class CameraPath
+{
+public:
+	void AddKeyframe(const CameraKeyframe& keyframe);
+	bool LoadFromFile(const std::string& path, std::string& error);
+
+	// a full circle around center, always looking at it
+	static CameraPath CreateTurntable(const glm::vec3& center, float radius, float height, float duration);
+
+	float GetDuration() const { return m_Keyframes.empty() ? 0.0f : m_Keyframes.back().time; }
+	// the last keyframe is the first one again, like the turntable
+	bool IsClosed() const;
+	bool IsEmpty() const { return m_Keyframes.empty(); }
+
+	void Evaluate(float time, glm::vec3& position, glm::vec3& forward) const;
+private:
+	std::vector<CameraKeyframe> m_Keyframes; // sorted by time
+};
@@ -0,0 +1,208 @@
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+namespace {
+	const char Magic[8] = { 'M', 'G', 'R', 'C', 'K', 'P', 'T', 0 };
+	constexpr uint32_t Version = 1;
+
+	size_t FileSize(uint32_t width, uint32_t height)
+	{
+		return sizeof(Checkpoint::Header) + (size_t)width * height * sizeof(glm::vec4);
+	}
+
+	bool IsValid(const Checkpoint::Header& header)
+	{
+		return memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version && header.frameCount >= 1;
+	}
+}
+
+Checkpoint::~Checkpoint()
+{
+	Close();
+}
+
+Checkpoint::OpenResult Checkpoint::Open(const std::string& path, uint32_t width, uint32_t height, uint32_t runSeed, bool overwrite, std::string& error)
+{
+	Close();
+	if (width == 0 || height == 0)
+	{
+		error = "the image is empty";
+		return OpenResult::Failed;
+	}
+
+	// look at the existing file first, mapping it sets the file to the new size
+	bool exists = false;
+	bool compatible = false;
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		Header existing;
+		exists = (bool)file;
+		if (file && (size_t)file.tellg() == FileSize(width, height) &&
+			file.seekg(0).read((char*)&existing, sizeof(Header)))
+		{
+			compatible = IsValid(existing) && existing.width == width && existing.height == height;
+		}
+	}
+
+	// the file could be hours of samples at another size or not a checkpoint at all, only replace it when asked to
+	if (exists && !compatible && !overwrite)
+	{
+		error = path + " is not a checkpoint of a " + std::to_string(width) + "x" + std::to_string(height) + " image, it is only replaced when overwriting is allowed";
+		return OpenResult::Failed;
+	}
+
+	if (!m_File.Open(path, FileSize(width, height)))
+	{
+		error = "could not map " + path;
+		return OpenResult::Failed;
+	}
+
+	OpenResult result = OpenResult::Resumed;
+	if (!compatible)
+	{
+		Header& header = GetHeader();
+		memset(&header, 0, sizeof(Header));
+		memcpy(header.magic, Magic, sizeof(Magic));
+		header.version = Version;
+		header.width = width;
+		header.height = height;
+		header.frameCount = 1;
+		header.runSeed = runSeed;
+		result = OpenResult::Created;
+	}
+
+	m_StopFlushing = false;
+	m_FlushThread = std::thread(&Checkpoint::FlushLoop, this);
+	return result;
+}
+
+void Checkpoint::Close()
+{
+	if (m_FlushThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_StopFlushing = true;
+		}
+		m_Wakeup.notify_all();
+		m_FlushThread.join();
+	}
+
+	if (m_File.IsOpen())
+	{
+		m_File.Flush();
+		m_File.Close();
+	}
+}
+
+void Checkpoint::SetFlushInterval(float seconds)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_FlushInterval = seconds;
+	}
+	m_Wakeup.notify_all();
+}
+
+void Checkpoint::FlushLoop()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (!m_StopFlushing)
+	{
+		if (m_FlushInterval <= 0.0f)
+		{
+			m_Wakeup.wait(lock);
+			continue;
+		}
+
+		if (m_Wakeup.wait_for(lock, std::chrono::duration<float>(m_FlushInterval)) == std::cv_status::timeout)
+		{
+			// the renderer keeps writing into the mapping while the pages go to the disk
+			lock.unlock();
+			m_File.Flush();
+			lock.lock();
+		}
+	}
+}
+
+bool Checkpoint::Merge(const std::vector<std::string>& inputs, const std::string& output, std::string& error)
+{
+	if (inputs.empty())
+	{
+		error = "nothing to merge";
+		return false;
+	}
+
+	Header merged;
+	std::vector<glm::vec4> sum;
+	std::vector<glm::vec4> pixels;
+	std::vector<uint32_t> seeds;
+	uint32_t frames = 0;
+
+	for (const std::string& path : inputs)
+	{
+		std::ifstream file(path, std::ios::binary);
+		Header header;
+		if (!file.read((char*)&header, sizeof(Header)) || !IsValid(header))
+		{
+			error = path + " is not a checkpoint";
+			return false;
+		}
+
+		if (sum.empty())
+		{
+			merged = header;
+			sum.assign((size_t)header.width * header.height, glm::vec4(0.0f));
+		}
+		else if (header.width != merged.width || header.height != merged.height ||
+			header.sceneHash != merged.sceneHash || header.cameraHash != merged.cameraHash)
+		{
+			error = path + " shows another scene, camera or resolution";
+			return false;
+		}
+
+		// two runs with the same seed took exactly the same samples
+		if (std::find(seeds.begin(), seeds.end(), header.runSeed) != seeds.end())
+		{
+			error = path + " uses the same random seed as another input";
+			return false;
+		}
+		seeds.push_back(header.runSeed);
+
+		pixels.resize(sum.size());
+		if (!file.read((char*)pixels.data(), pixels.size() * sizeof(glm::vec4)))
+		{
+			error = path + " is incomplete";
+			return false;
+		}
+
+		// the pixels are plain sums, so the merged image is their sum divided by all frames
+		for (size_t i = 0; i < sum.size(); i++)
+		{
+			sum[i] += pixels[i];
+		}
+		frames += header.frameCount - 1;
+	}
+
+	merged.frameCount = frames + 1;
+	// a merged checkpoint can be resumed too, so it gets a seed none of the inputs had
+	merged.runSeed = 0x9E3779B9u;
+	for (uint32_t seed : seeds)
+	{
+		merged.runSeed = (merged.runSeed ^ seed) * 0x01000193u;
+	}
+
+	std::ofstream file(output, std::ios::binary | std::ios::trunc);
+	file.write((const char*)&merged, sizeof(Header));
+	file.write((const char*)sum.data(), sum.size() * sizeof(glm::vec4));
+	if (!file)
+	{
+		error = "could not write " + output;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// keeps the accumulated samples of a render in a memory mapped file.
+// the renderer accumulates directly into the mapping, a background thread writes the
+// changed pages to the disk every few seconds. after a crash the render can be resumed
+// from the file, and files of independent runs can be merged into one image.
+//
+// the flush does not wait for a frame to finish, so a checkpoint can contain one sample
+// more in some pixels than the frame count says. this is not visible after a few frames
+class Checkpoint
+{
+public:
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t frameCount;	// same as Renderer::m_FrameCount, frameCount - 1 frames are accumulated
+		uint32_t runSeed;		// seed of the random numbers, every run needs its own for merging
+		uint32_t reserved;
+		uint64_t sceneHash;		// what was rendered, a resumed render has to match both
+		uint64_t cameraHash;
+		uint8_t padding[16];	// keeps the pixels after the header 16 byte aligned
+	};
+	static_assert(sizeof(Header) == 64, "the file layout depends on the header size");
+
+	enum class OpenResult
+	{
+		Failed = 0,
+		Created,	// new file, or an incompatible one which was allowed to be overwritten. starts with frame 1
+		Resumed		// the file holds samples of an earlier run with the same size
+	};
+
+	Checkpoint() = default;
+	~Checkpoint();
+
+	// an existing file which is no checkpoint of this size fails, unless overwrite is set
+	OpenResult Open(const std::string& path, uint32_t width, uint32_t height, uint32_t runSeed, bool overwrite, std::string& error);
+	void Close();
+	bool IsOpen() const { return m_File.IsOpen(); }
+
+	// 0 turns the background flushing off
+	void SetFlushInterval(float seconds);
+
+	Header& GetHeader() const { return *(Header*)m_File.GetData(); }
+	glm::vec4* GetAccumulation() const { return (glm::vec4*)((char*)m_File.GetData() + sizeof(Header)); }
+
+	// adds up the samples of several checkpoints of the same scene, camera and size into a new one
+	static bool Merge(const std::vector<std::string>& inputs, const std::string& output, std::string& error);
+private:
+	void FlushLoop();
+private:
+	MappedFile m_File;
+
+	std::thread m_FlushThread;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wakeup;
+	bool m_StopFlushing = false;
+	float m_FlushInterval = 30.0f;
+};
@@ -0,0 +1,583 @@
+#include "CommandLine.h"
+
+#include "BatchRenderer.h"
+#include "CameraPath.h"
+#include "Checkpoint.h"
+#include "ConvergenceBenchmark.h"
+#include "RenderCoordinator.h"
+#include "RenderProtocol.h"
+#include "RenderServer.h"
+#include "SceneLoader.h"
+#include "Socket.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+	void PrintUsage(const char* program)
+	{
+		printf("usage: %s [mode]\n", program);
+		printf("  without a mode the renderer window opens\n\n");
+		printf("  --merge <output> <input> <input> ...\n");
+		printf("      adds up the samples of checkpoints from independent runs of the same\n");
+		printf("      scene and camera, the output can be resumed like any other checkpoint\n\n");
+		printf("  --batch [--scene <file>] [--path <file>] [--frames <n>] [--spp <n>]\n");
+		printf("          [--width <w>] [--height <h>] [--out <pattern>] [--pipe <command>] [--numa <0|1>]\n");
+		printf("          [--memory-budget <MB>] [--spf <n>]\n");
+		printf("      renders a camera path into an image sequence (default frame_%%04d.ppm, the pattern\n");
+		printf("      has exactly one %%d with an optional width, %%%% for a percent sign)\n");
+		printf("      or pipes the frames as a PPM stream into an encoder, for example\n");
+		printf("      --pipe \"ffmpeg -y -f image2pipe -c:v ppm -i - out.mp4\"\n");
+		printf("      without --path the camera circles around the scene. --numa 1 pins the\n");
+		printf("      threads to the NUMA nodes and prints the throughput of every node.\n");
+		printf("      --spf takes n jittered samples per pass (anti aliased, fewer passes for the same spp),\n");
+		printf("      spp has to be a multiple of it\n\n");
+		printf("  --server <address> [--memory-budget <MB>]\n");
+		printf("      keeps scenes and renderers loaded and renders jobs sent to the address,\n");
+		printf("      which is unix:<path>, tcp:<port> (localhost only) or tcp:<host>:<port>.\n");
+		printf("      the budget is shared by the renderers of all cached scenes\n\n");
+		printf("  --submit <address> <output.ppm> [key=value ...]\n");
+		printf("      sends one job to a server and writes the returned tiles into an image.\n");
+		printf("      keys: scene camera size spp region tile seed (see RenderProtocol.h)\n\n");
+		printf("  --stop-server <address>\n\n");
+		printf("  --coordinate <output.ppm> [--workers <n>] [--connect <address>]... [key=value ...]\n");
+		printf("      renders one image on n local worker processes (default 2, at most 8 on windows) and on the\n");
+		printf("      servers given with --connect. keys: scene camera size spp tile seed\n\n");
+		printf("  --converge [--scenes <a,b,...>] [--size <w>x<h>] [--reference-spp <n>]\n");
+		printf("             [--reference-dir <dir>] [--budgets <seconds,...>] [--threshold <relMSE>]\n");
+		printf("             [--out <file.json>]\n");
+		printf("      renders every scene for fixed amounts of time and reports the error against\n");
+		printf("      a reference image (rendered once and kept as a checkpoint) as JSON\n\n");
+		printf("  --memory [--scene <file>] [--size <w>x<h>] [--budget <MB>]\n");
+		printf("      renders a few frames and prints the bytes the renderer holds per subsystem\n");
+		printf("      and the caches it gave up for the budget as JSON\n");
+	}
+
+	// "a,b,c" into its parts
+	std::vector<std::string> SplitList(const char* list)
+	{
+		std::vector<std::string> parts;
+		std::string part;
+		for (const char* c = list; ; c++)
+		{
+			if (*c == ',' || *c == '\0')
+			{
+				if (!part.empty())
+					parts.push_back(part);
+				part.clear();
+				if (*c == '\0')
+					break;
+			}
+			else
+			{
+				part += *c;
+			}
+		}
+		return parts;
+	}
+
+	// the output pattern is handed to snprintf with the frame number, so it must not contain anything else
+	// to format: exactly one %d, %i or %u with an optional 0 flag and width, and %% for a percent sign
+	bool IsFramePattern(const std::string& pattern)
+	{
+		int conversions = 0;
+		for (size_t i = 0; i < pattern.size(); i++)
+		{
+			if (pattern[i] != '%')
+				continue;
+			if (++i < pattern.size() && pattern[i] == '%')
+				continue;
+
+			while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9')
+				i++;
+			if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i' && pattern[i] != 'u'))
+				return false;
+			conversions++;
+		}
+		return conversions == 1;
+	}
+
+	int Merge(int argc, char** argv)
+	{
+		if (argc < 4)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		std::vector<std::string> inputs(argv + 3, argv + argc);
+		std::string error;
+		if (!Checkpoint::Merge(inputs, argv[2], error))
+		{
+			fprintf(stderr, "merge failed: %s\n", error.c_str());
+			return 1;
+		}
+
+		printf("merged %d checkpoints into %s\n", (int)inputs.size(), argv[2]);
+		return 0;
+	}
+
+	int Batch(int argc, char** argv)
+	{
+		BatchSettings settings;
+		std::string sceneFile, pathFile;
+
+		for (int i = 2; i < argc; i++)
+		{
+			// every option takes exactly one value
+			if (i + 1 >= argc)
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+			const char* option = argv[i];
+			const char* value = argv[++i];
+
+			if (strcmp(option, "--scene") == 0)
+				sceneFile = value;
+			else if (strcmp(option, "--path") == 0)
+				pathFile = value;
+			else if (strcmp(option, "--frames") == 0)
+				settings.frames = (uint32_t)atoi(value);
+			else if (strcmp(option, "--spp") == 0)
+				settings.samplesPerPixel = (uint32_t)atoi(value);
+			else if (strcmp(option, "--spf") == 0)
+				settings.samplesPerFrame = (uint32_t)atoi(value);
+			else if (strcmp(option, "--width") == 0)
+				settings.width = (uint32_t)atoi(value);
+			else if (strcmp(option, "--height") == 0)
+				settings.height = (uint32_t)atoi(value);
+			else if (strcmp(option, "--out") == 0)
+				settings.outputPattern = value;
+			else if (strcmp(option, "--pipe") == 0)
+				settings.pipeCommand = value;
+			else if (strcmp(option, "--numa") == 0)
+				settings.numaPinning = atoi(value) != 0;
+			else if (strcmp(option, "--memory-budget") == 0)
+				settings.memoryBudgetMB = (uint32_t)atoi(value);
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+
+		if (settings.width == 0 || settings.height == 0 || settings.frames == 0 || settings.samplesPerPixel == 0)
+		{
+			fprintf(stderr, "size, frames and spp have to be at least 1\n");
+			return 1;
+		}
+		if (settings.pipeCommand.empty() && !IsFramePattern(settings.outputPattern))
+		{
+			fprintf(stderr, "the output pattern needs exactly one frame number like %%04d and %%%% for a percent sign\n");
+			return 1;
+		}
+		// every pass has the same weight in the accumulation, a shorter last pass would count too much
+		if (settings.samplesPerFrame == 0 || settings.samplesPerPixel % settings.samplesPerFrame != 0)
+		{
+			fprintf(stderr, "spp (%u) has to be a multiple of spf (%u)\n", settings.samplesPerPixel, settings.samplesPerFrame);
+			return 1;
+		}
+
+		std::string error;
+		Scene scene = SceneLoader::CreateDefaultScene();
+		if (!sceneFile.empty() && !SceneLoader::LoadByName(sceneFile, scene, error))
+		{
+			fprintf(stderr, "could not load the scene: %s\n", error.c_str());
+			return 1;
+		}
+
+		// the default turntable starts where the interactive camera starts
+		CameraPath path = CameraPath::CreateTurntable(glm::vec3(0.0f), 6.0f, 0.0f, 10.0f);
+		if (!pathFile.empty())
+		{
+			path = CameraPath();
+			if (!path.LoadFromFile(pathFile, error))
+			{
+				fprintf(stderr, "could not load the camera path: %s\n", error.c_str());
+				return 1;
+			}
+		}
+
+		BatchRenderer batch(scene, path, settings);
+		if (!batch.Run(error))
+		{
+			fprintf(stderr, "batch render failed: %s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	int Server(int argc, char** argv)
+	{
+		uint32_t memoryBudget = 0;
+		if (argc == 5 && strcmp(argv[3], "--memory-budget") == 0)
+		{
+			memoryBudget = (uint32_t)atoi(argv[4]);
+		}
+		else if (argc != 3)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		RenderServer server;
+		server.SetMemoryBudget(memoryBudget);
+		std::string error;
+		if (!server.Run(argv[2], error))
+		{
+			fprintf(stderr, "server failed: %s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	int Submit(int argc, char** argv)
+	{
+		if (argc < 4)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		std::string line = "job";
+		for (int i = 4; i < argc; i++)
+		{
+			line += " ";
+			line += argv[i];
+		}
+
+		RenderJob job;
+		std::string error;
+		Socket socket;
+		bool parsed = RenderProtocol::ParseJob(line, job, error);
+		job.sums = false; // the image is written from the RGBA8 tiles
+		if (!parsed || !socket.Connect(argv[2], error)
+			|| !socket.SendLine(RenderProtocol::FormatJob(job)))
+		{
+			fprintf(stderr, "submit failed: %s\n", error.empty() ? "connection lost" : error.c_str());
+			return 1;
+		}
+
+		// pixels outside of the region stay black
+		std::vector<uint32_t> image((size_t)job.width * job.height, 0);
+		std::vector<uint32_t> pixels;
+
+		while (socket.ReceiveLine(line))
+		{
+			TileHeader tile;
+			if (RenderProtocol::ParseTile(line, sizeof(uint32_t), tile))
+			{
+				pixels.resize((size_t)tile.width * tile.height);
+				if (!socket.Receive(pixels.data(), tile.bytes)
+					|| tile.x + tile.width > job.width || tile.y + tile.height > job.height)
+					break;
+
+				for (uint32_t y = 0; y < tile.height; y++)
+				{
+					memcpy(&image[tile.x + (tile.y + y) * job.width], &pixels[y * tile.width], tile.width * sizeof(uint32_t));
+				}
+				continue;
+			}
+			if (line.rfind("tile", 0) == 0)
+				break; // the pixels do not fit the header, the rest of the stream can not be read
+
+			if (line.rfind("error", 0) == 0)
+			{
+				fprintf(stderr, "%s\n", line.c_str());
+				return 1;
+			}
+
+			if (line.rfind("done", 0) == 0)
+			{
+				FILE* file = fopen(argv[3], "wb");
+				if (!file)
+				{
+					fprintf(stderr, "could not write %s\n", argv[3]);
+					return 1;
+				}
+
+				// the renderer starts with the bottom row, PPM with the top one
+				fprintf(file, "P6\n%u %u\n255\n", job.width, job.height);
+				for (uint32_t y = job.height; y-- > 0;)
+				{
+					for (uint32_t x = 0; x < job.width; x++)
+					{
+						uint32_t pixel = image[x + y * job.width];
+						uint8_t rgb[3] = { (uint8_t)pixel, (uint8_t)(pixel >> 8), (uint8_t)(pixel >> 16) };
+						fwrite(rgb, 1, 3, file);
+					}
+				}
+				fclose(file);
+
+				printf("%s, written to %s\n", line.c_str(), argv[3]);
+				return 0;
+			}
+		}
+
+		fprintf(stderr, "submit failed: connection lost\n");
+		return 1;
+	}
+
+	int Coordinate(int argc, char** argv)
+	{
+		if (argc < 3)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		CoordinatorSettings settings;
+		settings.executable = argv[0];
+
+		std::string line = "job";
+		for (int i = 3; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+				settings.localWorkers = (uint32_t)atoi(argv[++i]);
+			else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+				settings.remoteWorkers.push_back(argv[++i]);
+			else
+				line += std::string(" ") + argv[i];
+		}
+
+		std::string error;
+		if (!RenderProtocol::ParseJob(line, settings.job, error))
+		{
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+
+		RenderCoordinator coordinator(settings);
+		if (!coordinator.Run(error))
+		{
+			fprintf(stderr, "render failed: %s\n", error.c_str());
+			return 1;
+		}
+		if (!coordinator.WritePPM(argv[2]))
+		{
+			fprintf(stderr, "could not write %s\n", argv[2]);
+			return 1;
+		}
+		return 0;
+	}
+
+	int Converge(int argc, char** argv)
+	{
+		ConvergenceSettings settings;
+		std::string output;
+
+		for (int i = 2; i < argc; i++)
+		{
+			// every option takes exactly one value
+			if (i + 1 >= argc)
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+			const char* option = argv[i];
+			const char* value = argv[++i];
+
+			bool ok = true;
+			if (strcmp(option, "--scenes") == 0)
+				settings.scenes = SplitList(value);
+			else if (strcmp(option, "--size") == 0)
+				ok = sscanf(value, "%ux%u", &settings.width, &settings.height) == 2;
+			else if (strcmp(option, "--reference-spp") == 0)
+				settings.referenceSpp = (uint32_t)atoi(value);
+			else if (strcmp(option, "--reference-dir") == 0)
+				settings.referenceDirectory = value;
+			else if (strcmp(option, "--threshold") == 0)
+				settings.threshold = (float)atof(value);
+			else if (strcmp(option, "--out") == 0)
+				output = value;
+			else if (strcmp(option, "--budgets") == 0)
+			{
+				settings.budgets.clear();
+				for (const std::string& budget : SplitList(value))
+					settings.budgets.push_back((float)atof(budget.c_str()));
+				std::sort(settings.budgets.begin(), settings.budgets.end());
+			}
+			else
+				ok = false;
+
+			if (!ok)
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+
+		if (settings.width == 0 || settings.height == 0 || settings.scenes.empty())
+		{
+			fprintf(stderr, "the size has to be at least 1x1 and there has to be a scene\n");
+			return 1;
+		}
+
+		ConvergenceBenchmark benchmark(settings);
+		std::string error;
+		if (!benchmark.Run(error))
+		{
+			fprintf(stderr, "benchmark failed: %s\n", error.c_str());
+			return 1;
+		}
+
+		std::string json = benchmark.ToJson();
+		if (output.empty())
+		{
+			printf("%s", json.c_str());
+			return 0;
+		}
+
+		FILE* file = fopen(output.c_str(), "wb");
+		if (!file || fwrite(json.data(), 1, json.size(), file) != json.size())
+		{
+			fprintf(stderr, "could not write %s\n", output.c_str());
+			if (file)
+				fclose(file);
+			return 1;
+		}
+		fclose(file);
+		printf("results written to %s\n", output.c_str());
+		return 0;
+	}
+
+	int Memory(int argc, char** argv)
+	{
+		std::string sceneName = "default";
+		uint32_t width = 1280, height = 720, budget = 0;
+
+		for (int i = 2; i < argc; i++)
+		{
+			// every option takes exactly one value
+			if (i + 1 >= argc)
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+			const char* option = argv[i];
+			const char* value = argv[++i];
+
+			bool ok = true;
+			if (strcmp(option, "--scene") == 0)
+				sceneName = value;
+			else if (strcmp(option, "--size") == 0)
+				ok = sscanf(value, "%ux%u", &width, &height) == 2 && width > 0 && height > 0;
+			else if (strcmp(option, "--budget") == 0)
+				budget = (uint32_t)atoi(value);
+			else
+				ok = false;
+
+			if (!ok)
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+
+		std::string error;
+		Scene scene;
+		if (!SceneLoader::LoadByName(sceneName, scene, error))
+		{
+			fprintf(stderr, "could not load the scene: %s\n", error.c_str());
+			return 1;
+		}
+
+		Renderer renderer(true);
+		renderer.GetSettings().MemoryBudgetMB = budget;
+		renderer.onResize(width, height);
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(width, height);
+
+		// the first frame decides what fits, the second one runs without the dropped caches
+		for (int frame = 0; frame < 2; frame++)
+		{
+			camera.SetRayDirectionCache(renderer.WantsRayDirectionCache());
+			renderer.Render(scene, camera);
+		}
+
+		const Renderer::MemoryUsage& memory = renderer.GetMemoryUsage();
+		printf("{\n");
+		printf("  \"scene\": \"%s\",\n", EscapeJson(sceneName).c_str());
+		printf("  \"width\": %u,\n  \"height\": %u,\n", width, height);
+		printf("  \"budget_bytes\": %zu,\n", (size_t)budget << 20);
+		printf("  \"framebuffers\": %zu,\n", memory.framebuffers);
+		printf("  \"ray_cache\": %zu,\n", memory.rayCache);
+		printf("  \"scene_arrays\": %zu,\n", memory.scene);
+		printf("  \"acceleration\": %zu,\n", memory.acceleration);
+		printf("  \"scheduling\": %zu,\n", memory.scheduling);
+		printf("  \"total\": %zu,\n", memory.Total());
+		std::string dropped;
+		for (auto [isDropped, name] : { std::make_pair(memory.tileBinsDropped, "tile_bins"),
+			std::make_pair(memory.rayCacheDropped, "ray_cache"), std::make_pair(memory.wideBVHDropped, "wide_bvh") })
+		{
+			if (isDropped)
+				dropped += std::string(dropped.empty() ? "" : ", ") + "\"" + name + "\"";
+		}
+		printf("  \"dropped\": [%s],\n", dropped.c_str());
+		printf("  \"over_budget\": %s\n", memory.overBudget ? "true" : "false");
+		printf("}\n");
+		return 0;
+	}
+
+	int StopServer(int argc, char** argv)
+	{
+		if (argc != 3)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		Socket socket;
+		std::string error;
+		if (!socket.Connect(argv[2], error) || !socket.SendLine("quit"))
+		{
+			fprintf(stderr, "could not stop the server: %s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int CommandLine::Run(int argc, char** argv)
+{
+	if (argc < 2)
+		return -1;
+
+	if (strcmp(argv[1], "--merge") == 0)
+		return Merge(argc, argv);
+
+	if (strcmp(argv[1], "--batch") == 0)
+		return Batch(argc, argv);
+
+	if (strcmp(argv[1], "--server") == 0)
+		return Server(argc, argv);
+
+	if (strcmp(argv[1], "--submit") == 0)
+		return Submit(argc, argv);
+
+	if (strcmp(argv[1], "--stop-server") == 0)
+		return StopServer(argc, argv);
+
+	if (strcmp(argv[1], "--coordinate") == 0)
+		return Coordinate(argc, argv);
+
+	if (strcmp(argv[1], "--converge") == 0)
+		return Converge(argc, argv);
+
+	if (strcmp(argv[1], "--memory") == 0)
+		return Memory(argc, argv);
+
+	if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)
+	{
+		PrintUsage(argv[0]);
+		return 0;
+	}
+
+	return -1;
+}
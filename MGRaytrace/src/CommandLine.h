@@ -0,0 +1,9 @@
+#pragma once
+
+// modes of the application which run without opening a window
+namespace CommandLine {
+
+	// runs the mode given by the arguments and returns its exit code,
+	// or -1 if there is none and the application should start normally
+	int Run(int argc, char** argv);
+}
@@ -0,0 +1,216 @@
+#include "ConvergenceBenchmark.h"
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "SceneLoader.h"
+
+#include "Walnut/Timer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+	// the reference file name may not contain the path separators of a scene file name
+	std::string ReferencePath(const std::string& directory, const std::string& scene, uint32_t width, uint32_t height)
+	{
+		std::string name = scene;
+		for (char& c : name)
+		{
+			if (c == '/' || c == '\\' || c == ':' || c == '.' || c == ' ')
+				c = '_';
+		}
+		return directory + "/reference_" + name + "_" + std::to_string(width) + "x" + std::to_string(height) + ".ckpt";
+	}
+
+	// root mean squared error and relative MSE (squared error divided by the squared reference,
+	// so dark regions count as much as bright ones) of the rgb channels
+	void ComputeError(const glm::vec4* accumulation, uint32_t frames, const std::vector<float>& reference, float& rmse, float& relMse)
+	{
+		double squared = 0.0, relative = 0.0;
+		size_t pixelCount = reference.size() / 3;
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			glm::vec4 color = accumulation[i] / (float)frames;
+			for (int c = 0; c < 3; c++)
+			{
+				double expected = reference[i * 3 + c];
+				double difference = (double)color[c] - expected;
+				squared += difference * difference;
+				relative += difference * difference / (expected * expected + 0.01);
+			}
+		}
+		rmse = (float)std::sqrt(squared / (double)reference.size());
+		relMse = (float)(relative / (double)reference.size());
+	}
+}
+
+std::string EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '\\' || c == '"')
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+			escaped += code;
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+ConvergenceBenchmark::ConvergenceBenchmark(const ConvergenceSettings& settings)
+	: m_Settings(settings)
+{
+}
+
+bool ConvergenceBenchmark::RenderReference(const std::string& sceneName, const Scene& scene, std::vector<float>& reference, uint32_t& spp, uint32_t& seed, std::string& error)
+{
+	Renderer renderer(true);
+	Camera camera(45.0f, 0.1f, 100.0f);
+	camera.OnResize(m_Settings.width, m_Settings.height);
+	renderer.onResize(m_Settings.width, m_Settings.height);
+
+	// a checkpoint of another scene, camera or size starts over by itself. the files are named after
+	// the scene and size and only written by this benchmark, so an outdated one may be overwritten
+	std::string path = ReferencePath(m_Settings.referenceDirectory, sceneName, m_Settings.width, m_Settings.height);
+	if (renderer.EnableCheckpoint(path, 30.0f, true) == Checkpoint::OpenResult::Failed)
+	{
+		error = renderer.GetCheckpointNotice();
+		return false;
+	}
+
+	// at least one frame, the first Render call compares the file with the scene and camera
+	uint32_t resumed = renderer.GetAccumulatedFrames();
+	do
+	{
+		renderer.Render(scene, camera);
+	} while (renderer.GetAccumulatedFrames() < m_Settings.referenceSpp);
+	if (resumed + 1 < renderer.GetAccumulatedFrames())
+	{
+		printf("%s: rendered the reference up to %u spp into %s\n", sceneName.c_str(), renderer.GetAccumulatedFrames(), path.c_str());
+	}
+
+	spp = renderer.GetAccumulatedFrames();
+	seed = renderer.GetRunSeed(); // the one of the checkpoint
+	const glm::vec4* accumulation = renderer.GetAccumulationData();
+	size_t pixelCount = (size_t)m_Settings.width * m_Settings.height;
+	reference.resize(pixelCount * 3);
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		glm::vec4 color = accumulation[i] / (float)spp;
+		reference[i * 3 + 0] = color.r;
+		reference[i * 3 + 1] = color.g;
+		reference[i * 3 + 2] = color.b;
+	}
+
+	renderer.DisableCheckpoint();
+	return true;
+}
+
+bool ConvergenceBenchmark::Run(std::string& error)
+{
+	m_Results.clear();
+	if (m_Settings.budgets.empty())
+	{
+		error = "no time budgets";
+		return false;
+	}
+
+	for (const std::string& sceneName : m_Settings.scenes)
+	{
+		ConvergenceResult& result = m_Results.emplace_back();
+		result.scene = sceneName;
+
+		Scene scene;
+		if (!SceneLoader::LoadByName(sceneName, scene, error))
+			return false;
+
+		std::vector<float> reference;
+		uint32_t referenceSeed = 0;
+		if (!RenderReference(sceneName, scene, reference, result.referenceSpp, referenceSeed, error))
+			return false;
+
+		// a fresh renderer with a seed of its own, the reference noise must not correlate with the measured one.
+		// derived from the seed of the reference so the measurement is the same every time for the same reference
+		Renderer renderer(true);
+		renderer.SetRunSeed(referenceSeed + 1);
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(m_Settings.width, m_Settings.height);
+		renderer.onResize(m_Settings.width, m_Settings.height);
+
+		// the first frame also builds the BVH, that is part of the time to the first image
+		float seconds = 0.0f;
+		size_t nextBudget = 0;
+		while (nextBudget < m_Settings.budgets.size())
+		{
+			Walnut::Timer timer;
+			renderer.Render(scene, camera);
+			seconds += timer.ElapsedMillis() / 1000.0f;
+
+			uint32_t spp = renderer.GetAccumulatedFrames();
+			float rmse, relMse;
+			ComputeError(renderer.GetAccumulationData(), spp, reference, rmse, relMse);
+
+			if (result.timeToThreshold < 0.0f && relMse <= m_Settings.threshold)
+			{
+				result.timeToThreshold = seconds;
+				result.sppToThreshold = spp;
+			}
+
+			while (nextBudget < m_Settings.budgets.size() && seconds >= m_Settings.budgets[nextBudget])
+			{
+				result.points.push_back({ m_Settings.budgets[nextBudget], seconds, spp, rmse, relMse });
+				nextBudget++;
+			}
+		}
+
+		const ConvergencePoint& last = result.points.back();
+		printf("%s: %u spp in %.2f s, rmse %.5f, relMSE %.5f, threshold %s\n", sceneName.c_str(), last.spp, last.seconds, last.rmse, last.relMse,
+			result.timeToThreshold < 0.0f ? "not reached" : (std::to_string(result.timeToThreshold) + " s").c_str());
+	}
+	return true;
+}
+
+std::string ConvergenceBenchmark::ToJson() const
+{
+	std::ostringstream json;
+	json << "{\n";
+	json << "  \"width\": " << m_Settings.width << ",\n";
+	json << "  \"height\": " << m_Settings.height << ",\n";
+	json << "  \"threshold\": " << m_Settings.threshold << ",\n";
+	json << "  \"scenes\": [\n";
+	for (size_t i = 0; i < m_Results.size(); i++)
+	{
+		const ConvergenceResult& result = m_Results[i];
+
+		// scene names can be file paths with backslashes
+		json << "    {\n";
+		json << "      \"scene\": \"" << EscapeJson(result.scene) << "\",\n";
+		json << "      \"referenceSpp\": " << result.referenceSpp << ",\n";
+		json << "      \"timeToThreshold\": " << (result.timeToThreshold < 0.0f ? std::string("null") : std::to_string(result.timeToThreshold)) << ",\n";
+		json << "      \"sppToThreshold\": " << (result.timeToThreshold < 0.0f ? std::string("null") : std::to_string(result.sppToThreshold)) << ",\n";
+		json << "      \"points\": [\n";
+		for (size_t p = 0; p < result.points.size(); p++)
+		{
+			const ConvergencePoint& point = result.points[p];
+			json << "        { \"budget\": " << point.budget << ", \"seconds\": " << point.seconds << ", \"spp\": " << point.spp
+				<< ", \"rmse\": " << point.rmse << ", \"relMse\": " << point.relMse << " }" << (p + 1 < result.points.size() ? "," : "") << "\n";
+		}
+		json << "      ]\n";
+		json << "    }" << (i + 1 < m_Results.size() ? "," : "") << "\n";
+	}
+	json << "  ]\n";
+	json << "}\n";
+	return json.str();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ConvergenceSettings
+{
+	std::vector<std::string> scenes{ "default", "bounce" }; // names as in SceneLoader::LoadByName
+	uint32_t width = 320;
+	uint32_t height = 180;
+	uint32_t referenceSpp = 2048;
+	std::string referenceDirectory = ".";
+	std::vector<float> budgets{ 0.5f, 1.0f, 2.0f, 4.0f, 8.0f }; // seconds of rendering
+	float threshold = 0.01f; // relMSE which counts as converged
+};
+
+struct ConvergencePoint
+{
+	float budget;	// seconds
+	float seconds;	// rendering time of the frames up to the budget, the last frame can pass it a little
+	uint32_t spp;
+	float rmse;
+	float relMse;
+};
+
+struct ConvergenceResult
+{
+	std::string scene;
+	uint32_t referenceSpp = 0;
+	std::vector<ConvergencePoint> points;
+	float timeToThreshold = -1.0f; // -1 if the threshold was not reached within the largest budget
+	uint32_t sppToThreshold = 0;
+};
+
+// the text as the contents of a JSON string: quotes, backslashes and control characters escaped
+std::string EscapeJson(const std::string& text);
+
+// measures how fast the renderer converges instead of how many rays per second it traces:
+// the error against a reference image after fixed amounts of time.
+//
+// the reference is rendered once with a seed of its own and kept as a checkpoint file,
+// later runs only render the missing samples. the time for the error computation after
+// every frame is not counted, only the Render calls are
+class ConvergenceBenchmark
+{
+public:
+	explicit ConvergenceBenchmark(const ConvergenceSettings& settings);
+
+	bool Run(std::string& error);
+
+	const std::vector<ConvergenceResult>& GetResults() const { return m_Results; }
+	std::string ToJson() const;
+private:
+	bool RenderReference(const std::string& sceneName, const Scene& scene, std::vector<float>& reference, uint32_t& spp, uint32_t& seed, std::string& error);
+private:
+	ConvergenceSettings m_Settings;
+	std::vector<ConvergenceResult> m_Results;
+};
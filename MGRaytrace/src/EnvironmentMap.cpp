@@ -0,0 +1,169 @@
+#include "EnvironmentMap.h"
+
+#include "stb_image.h"
+
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+
+bool EnvironmentMap::Load(const std::string& path, std::string& error)
+{
+	int width, height, channels;
+	float* pixels = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+	if (!pixels)
+	{
+		error = "could not load " + path + ": " + stbi_failure_reason();
+		return false;
+	}
+
+	m_Path = path;
+	m_Width = (uint32_t)width;
+	m_Height = (uint32_t)height;
+	m_BlocksPerRow = (m_Width + BlockSize - 1) / BlockSize;
+	uint32_t blockRows = (m_Height + BlockSize - 1) / BlockSize;
+
+	m_Texels.assign((size_t)m_BlocksPerRow * blockRows * BlockSize * BlockSize, glm::vec3(0.0f));
+	for (uint32_t y = 0; y < m_Height; y++)
+	{
+		for (uint32_t x = 0; x < m_Width; x++)
+		{
+			const float* pixel = pixels + ((size_t)x + (size_t)y * m_Width) * 3;
+			m_Texels[TexelIndex(x, y)] = glm::vec3(pixel[0], pixel[1], pixel[2]);
+		}
+	}
+	stbi_image_free(pixels);
+
+	BuildAliasTable();
+	return true;
+}
+
+uint32_t EnvironmentMap::TexelIndex(uint32_t x, uint32_t y) const
+{
+	uint32_t block = (y / BlockSize) * m_BlocksPerRow + x / BlockSize;
+	return block * BlockSize * BlockSize + (y % BlockSize) * BlockSize + x % BlockSize;
+}
+
+// u goes once around the horizon starting at -z, v from straight up (0) to straight down (1)
+uint32_t EnvironmentMap::DirectionToTexel(const glm::vec3& direction, float& sinTheta) const
+{
+	float cosTheta = glm::clamp(direction.y, -1.0f, 1.0f);
+	sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+
+	float u = 0.5f + glm::atan(direction.x, -direction.z) / glm::two_pi<float>();
+	float v = glm::acos(cosTheta) / glm::pi<float>();
+
+	uint32_t x = std::min((uint32_t)(u * (float)m_Width), m_Width - 1);
+	uint32_t y = std::min((uint32_t)(v * (float)m_Height), m_Height - 1);
+	return x + y * m_Width;
+}
+
+glm::vec3 EnvironmentMap::Evaluate(const glm::vec3& direction) const
+{
+	float sinTheta;
+	uint32_t texel = DirectionToTexel(direction, sinTheta);
+	return m_Texels[TexelIndex(texel % m_Width, texel / m_Width)] * Intensity;
+}
+
+void EnvironmentMap::BuildAliasTable()
+{
+	const uint32_t texelCount = m_Width * m_Height;
+
+	// the rows near the poles cover less of the sphere, sin(theta) accounts for that
+	std::vector<double> weights(texelCount);
+	double total = 0.0;
+	for (uint32_t y = 0; y < m_Height; y++)
+	{
+		float sinTheta = glm::sin(glm::pi<float>() * ((float)y + 0.5f) / (float)m_Height);
+		for (uint32_t x = 0; x < m_Width; x++)
+		{
+			const glm::vec3& texel = m_Texels[TexelIndex(x, y)];
+			float luminance = 0.2126f * texel.r + 0.7152f * texel.g + 0.0722f * texel.b;
+			weights[x + y * m_Width] = (double)(glm::max(luminance, 0.0f) * sinTheta);
+			total += weights[x + y * m_Width];
+		}
+	}
+
+	// a black image is sampled uniformly instead
+	if (total <= 0.0)
+	{
+		std::fill(weights.begin(), weights.end(), 1.0);
+		total = (double)texelCount;
+	}
+
+	// vose's method: texels below the average are topped up by one texel above it
+	m_Alias.resize(texelCount);
+	std::vector<double> scaled(texelCount);
+	std::vector<uint32_t> small, large;
+	for (uint32_t i = 0; i < texelCount; i++)
+	{
+		m_Alias[i].probability = (float)(weights[i] / total);
+		scaled[i] = weights[i] / total * (double)texelCount;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		uint32_t less = small.back();
+		small.pop_back();
+		uint32_t more = large.back();
+
+		m_Alias[less].threshold = (float)scaled[less];
+		m_Alias[less].alias = more;
+
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	// whatever is left is 1 up to rounding errors
+	for (uint32_t i : small)
+	{
+		m_Alias[i].threshold = 1.0f;
+		m_Alias[i].alias = i;
+	}
+	for (uint32_t i : large)
+	{
+		m_Alias[i].threshold = 1.0f;
+		m_Alias[i].alias = i;
+	}
+}
+
+glm::vec3 EnvironmentMap::Sample(float u0, float u1, float u2, float u3, glm::vec3& direction, float& pdf) const
+{
+	const uint32_t texelCount = (uint32_t)m_Alias.size();
+
+	// the fraction of u0 * texelCount only has the bits left over from the column, for large maps
+	// that are too few for the threshold, so the decision gets a number of its own
+	uint32_t texel = std::min((uint32_t)(u0 * (float)texelCount), texelCount - 1);
+	if (u3 >= m_Alias[texel].threshold)
+		texel = m_Alias[texel].alias;
+
+	uint32_t x = texel % m_Width;
+	uint32_t y = texel / m_Width;
+
+	// a random point inside the texel
+	float u = ((float)x + u1) / (float)m_Width;
+	float v = ((float)y + u2) / (float)m_Height;
+
+	float phi = (u - 0.5f) * glm::two_pi<float>();
+	float theta = v * glm::pi<float>();
+	float sinTheta = glm::sin(theta);
+	direction = glm::vec3(sinTheta * glm::sin(phi), glm::cos(theta), -sinTheta * glm::cos(phi));
+
+	// from the density over the image to the density over the sphere
+	pdf = sinTheta > 0.0f ? m_Alias[texel].probability * (float)texelCount / (2.0f * glm::pi<float>() * glm::pi<float>() * sinTheta) : 0.0f;
+
+	return m_Texels[TexelIndex(x, y)] * Intensity;
+}
+
+float EnvironmentMap::Pdf(const glm::vec3& direction) const
+{
+	float sinTheta;
+	uint32_t texel = DirectionToTexel(direction, sinTheta);
+	if (sinTheta <= 0.0f)
+		return 0.0f;
+
+	return m_Alias[texel].probability * (float)m_Alias.size() / (2.0f * glm::pi<float>() * glm::pi<float>() * sinTheta);
+}
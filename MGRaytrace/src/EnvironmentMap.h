@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// an HDR image of the surroundings in equirectangular (latitude/longitude) layout which
+// lights the scene wherever a ray leaves it.
+//
+// the texels are stored in 8x8 blocks instead of rows, neighbouring directions are then
+// mostly in the same cache lines. for importance sampling every texel gets a probability
+// proportional to its brightness times its solid angle, an alias table turns two random
+// numbers into a texel in constant time no matter how concentrated the light is
+class EnvironmentMap
+{
+public:
+	// radiance HDR (.hdr) or any other format stb_image can read as floats
+	bool Load(const std::string& path, std::string& error);
+
+	const std::string& GetPath() const { return m_Path; }
+	uint32_t GetWidth() const { return m_Width; }
+	uint32_t GetHeight() const { return m_Height; }
+	size_t GetMemorySize() const { return m_Texels.capacity() * sizeof(glm::vec3) + m_Alias.capacity() * sizeof(AliasEntry); }
+
+	float Intensity = 1.0f;
+
+	// the light arriving from the direction
+	glm::vec3 Evaluate(const glm::vec3& direction) const;
+
+	// picks a direction with the probability of its brightness, pdf is per solid angle.
+	// u0 picks the column of the alias table, u3 decides between texel and alias
+	glm::vec3 Sample(float u0, float u1, float u2, float u3, glm::vec3& direction, float& pdf) const;
+	float Pdf(const glm::vec3& direction) const;
+private:
+	struct AliasEntry
+	{
+		float threshold;	// below this the texel itself is taken, otherwise its alias
+		uint32_t alias;
+		float probability;	// of the texel itself, needed to compute the pdf
+	};
+
+	uint32_t TexelIndex(uint32_t x, uint32_t y) const;
+	uint32_t DirectionToTexel(const glm::vec3& direction, float& sinTheta) const;
+	void BuildAliasTable();
+private:
+	static constexpr uint32_t BlockSize = 8;
+
+	std::string m_Path;
+	uint32_t m_Width = 0;
+	uint32_t m_Height = 0;
+	uint32_t m_BlocksPerRow = 0;
+
+	std::vector<glm::vec3> m_Texels;	// in 8x8 blocks, see TexelIndex
+	std::vector<AliasEntry> m_Alias;	// one per texel, in rows
+};
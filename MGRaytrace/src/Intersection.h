@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Ray.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+#include <limits>
+#include <utility>
+
+// the intersection tests for the primitives of the scene.
+// they are shared between the brute force loop in the renderer and the BVH traversal
+namespace Intersection {
+
+	// returns the distance to the closest hit in front of the ray or a negative value if there is none
+	inline float Sphere(const Ray& ray, const ::Sphere& sphere)
+	{
+		// the following equation defines the points of an intersection between a ray and a circle
+		// (bx^2 + by^2)t^2 + (2axbx + 2ayby)t + (ax^2 + ay^2 - r^2) = 0
+		// simplify by factoring 2 out
+		// (bx^2 + by^2)t^2 + (2(axbx + ayby))t + (ax^2 + ay^2 - r^2) = 0
+		// a is the origin / pixel; b is the direction; r is sphere radius; t is intersection distance
+		glm::vec3 origin = ray.Origin - sphere.Position;
+
+		float a = glm::dot(ray.Direction, ray.Direction);
+		float b = 2.0f * glm::dot(origin, ray.Direction);
+		float c = glm::dot(origin, origin) - sphere.radius * sphere.radius;
+
+		// calculate the discriminant of the PQ-formula: b^2 - 4ac
+		float discr = b * b - 4.0f * a * c;
+
+		if (discr < 0.0f) // ray didnt hit anything
+		{
+			return -1.0f;
+		}
+
+		// now use the PQ-formula to get points of intersection (-b (+-) sqrt(discr)) / 2a
+		// the other point (-b + sqrt(discr)) / 2a is always further away as a > 0
+		return (-b - glm::sqrt(discr)) / (2.0f * a);
+	}
+
+	// slab test against the box, returns the entry distance or a negative value if there is none
+	inline float Cube(const Ray& ray, const ::Cube& cube)
+	{
+		float tMin = 0.0f; // Start of the ray
+		float tMax = std::numeric_limits<float>::max(); // Farthest intersection point
+
+		// Iterate over each axis (x, y, z)
+		for (int i = 0; i < 3; ++i) {
+			float invD = 1.0f / ray.Direction[i];
+			float t0 = (cube.min[i] - ray.Origin[i]) * invD;
+			float t1 = (cube.max[i] - ray.Origin[i]) * invD;
+
+			if (invD < 0.0f) {
+				std::swap(t0, t1);
+			}
+
+			tMin = t0 > tMin ? t0 : tMin;
+			tMax = t1 < tMax ? t1 : tMax;
+
+			if (tMax <= tMin) {
+				return -1.0f; // No intersection
+			}
+		}
+		return tMin;
+	}
+}
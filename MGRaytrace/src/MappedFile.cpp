@@ -0,0 +1,134 @@
+#include "MappedFile.h"
+
+#include <cstdint>
+
+#ifdef WL_PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef WL_PLATFORM_WINDOWS
+
+bool MappedFile::Open(const std::string& path, size_t size)
+{
+	Close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// grow or shrink the file to the size of the mapping
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = (LONGLONG)size;
+	if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_File = file;
+	m_Mapping = mapping;
+	m_Data = data;
+	m_Size = size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+	{
+		UnmapViewOfFile(m_Data);
+		CloseHandle((HANDLE)m_Mapping);
+		CloseHandle((HANDLE)m_File);
+	}
+	m_Data = nullptr;
+	m_Mapping = nullptr;
+	m_File = nullptr;
+	m_Size = 0;
+}
+
+bool MappedFile::Flush()
+{
+	if (!m_Data)
+		return false;
+
+	// FlushViewOfFile only starts writing the pages, FlushFileBuffers waits for the disk
+	return FlushViewOfFile(m_Data, 0) && FlushFileBuffers((HANDLE)m_File);
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path, size_t size)
+{
+	Close();
+
+	int file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (file < 0)
+		return false;
+
+	// grow or shrink the file to the size of the mapping
+	if (ftruncate(file, (off_t)size) != 0)
+	{
+		close(file);
+		return false;
+	}
+
+	void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	if (data == MAP_FAILED)
+	{
+		close(file);
+		return false;
+	}
+
+	m_File = file;
+	m_Data = data;
+	m_Size = size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+	{
+		munmap(m_Data, m_Size);
+		close(m_File);
+	}
+	m_Data = nullptr;
+	m_File = -1;
+	m_Size = 0;
+}
+
+bool MappedFile::Flush()
+{
+	if (!m_Data)
+		return false;
+
+	return msync(m_Data, m_Size, MS_SYNC) == 0;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// a file mapped into memory for reading and writing.
+// writes to GetData() end up in the file without any copy, Flush() forces them onto the disk
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// opens or creates the file, sets it to exactly size bytes and maps all of it
+	bool Open(const std::string& path, size_t size);
+	void Close();
+
+	// blocks until all changed pages are written to the disk
+	bool Flush();
+
+	bool IsOpen() const { return m_Data != nullptr; }
+	void* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+private:
+	void* m_Data = nullptr;
+	size_t m_Size = 0;
+
+#ifdef WL_PLATFORM_WINDOWS
+	void* m_File = nullptr;		// HANDLE
+	void* m_Mapping = nullptr;	// HANDLE
+#else
+	int m_File = -1;
+#endif
+};
@@ -0,0 +1,105 @@
+#include "NumaThreadPool.h"
+
+NumaThreadPool::NumaThreadPool(const NumaTopology& topology)
+{
+	for (const NumaTopology::Node& node : topology.nodes)
+	{
+		auto state = std::make_unique<NodeState>();
+		state->id = node.id;
+		state->threadCount = (uint32_t)node.cpus.size();
+		m_Nodes.push_back(std::move(state));
+	}
+
+	for (uint32_t node = 0; node < (uint32_t)topology.nodes.size(); node++)
+	{
+		for (uint32_t cpu : topology.nodes[node].cpus)
+		{
+			m_Threads.emplace_back(&NumaThreadPool::WorkerLoop, this, node, cpu);
+		}
+	}
+}
+
+NumaThreadPool::~NumaThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_WorkReady.notify_all();
+
+	for (std::thread& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+void NumaThreadPool::ForEachRow(uint32_t rowCount, const std::function<void(uint32_t)>& function)
+{
+	// the bands follow the number of threads, a node with twice the CPUs gets twice the rows
+	uint32_t totalThreads = (uint32_t)m_Threads.size();
+	uint32_t threadsBefore = 0;
+	for (auto& node : m_Nodes)
+	{
+		node->firstRow = (uint32_t)((uint64_t)rowCount * threadsBefore / totalThreads);
+		threadsBefore += node->threadCount;
+		node->endRow = (uint32_t)((uint64_t)rowCount * threadsBefore / totalThreads);
+		node->nextRow = node->firstRow;
+		node->runningThreads = node->threadCount;
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Function = &function;
+	m_BusyThreads = totalThreads;
+	m_Start = std::chrono::steady_clock::now();
+	m_Generation++;
+	m_WorkReady.notify_all();
+
+	m_WorkDone.wait(lock, [this] { return m_BusyThreads == 0; });
+	m_Function = nullptr;
+}
+
+void NumaThreadPool::WorkerLoop(uint32_t nodeIndex, uint32_t cpu)
+{
+	NumaTopology::PinCurrentThread(cpu);
+	NodeState& node = *m_Nodes[nodeIndex];
+
+	uint64_t generation = 0;
+	while (true)
+	{
+		const std::function<void(uint32_t)>* function;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WorkReady.wait(lock, [&] { return m_Stopping || m_Generation != generation; });
+			if (m_Stopping)
+				return;
+
+			generation = m_Generation;
+			function = m_Function;
+		}
+
+		// inside the band the rows are handed out one by one, so the threads of a node stay balanced
+		for (uint32_t row = node.nextRow++; row < node.endRow; row = node.nextRow++)
+		{
+			(*function)(row);
+		}
+
+		if (--node.runningThreads == 0)
+		{
+			node.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_Start).count();
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_BusyThreads == 0)
+			m_WorkDone.notify_one();
+	}
+}
+
+std::vector<NumaThreadPool::NodeStatistics> NumaThreadPool::GetStatistics() const
+{
+	std::vector<NodeStatistics> statistics;
+	for (const auto& node : m_Nodes)
+	{
+		statistics.push_back({ node->id, node->threadCount, node->endRow - node->firstRow, node->milliseconds });
+	}
+	return statistics;
+}
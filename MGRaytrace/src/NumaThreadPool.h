@@ -0,0 +1,67 @@
+#pragma once
+
+#include "NumaTopology.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// worker threads pinned to the CPUs of every NUMA node.
+//
+// ForEachRow gives every node a fixed band of the rows, sized by its number of threads, and only
+// the threads of that node work on it. the same rows always end up on the same node, so a buffer
+// which was first touched through ForEachRow has the pages of every band in the memory of the
+// node which renders it (linux and windows place a page on the node of the thread touching it first)
+class NumaThreadPool
+{
+public:
+	struct NodeStatistics
+	{
+		uint32_t node;
+		uint32_t threads;
+		uint32_t rows;			// of the last ForEachRow
+		float milliseconds;		// until the last thread of the node was done
+	};
+
+	explicit NumaThreadPool(const NumaTopology& topology);
+	~NumaThreadPool();
+
+	NumaThreadPool(const NumaThreadPool&) = delete;
+	NumaThreadPool& operator=(const NumaThreadPool&) = delete;
+
+	// calls function(row) for every row below rowCount and returns when all of them are done
+	void ForEachRow(uint32_t rowCount, const std::function<void(uint32_t)>& function);
+
+	uint32_t GetNodeCount() const { return (uint32_t)m_Nodes.size(); }
+	std::vector<NodeStatistics> GetStatistics() const;
+private:
+	struct NodeState
+	{
+		uint32_t id = 0;
+		uint32_t threadCount = 0;
+		uint32_t firstRow = 0, endRow = 0;
+		std::atomic<uint32_t> nextRow{ 0 };
+		std::atomic<uint32_t> runningThreads{ 0 };
+		float milliseconds = 0.0f;
+	};
+
+	void WorkerLoop(uint32_t node, uint32_t cpu);
+private:
+	std::vector<std::unique_ptr<NodeState>> m_Nodes;
+	std::vector<std::thread> m_Threads;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkReady;
+	std::condition_variable m_WorkDone;
+	const std::function<void(uint32_t)>* m_Function = nullptr;
+	uint64_t m_Generation = 0;		// counts the ForEachRow calls, wakes up the workers
+	uint32_t m_BusyThreads = 0;
+	bool m_Stopping = false;
+	std::chrono::steady_clock::time_point m_Start;
+};
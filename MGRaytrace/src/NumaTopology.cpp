@@ -0,0 +1,160 @@
+#include "NumaTopology.h"
+
+#include <thread>
+
+#ifdef WL_PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+uint32_t NumaTopology::GetCpuCount() const
+{
+	uint32_t count = 0;
+	for (const Node& node : nodes)
+	{
+		count += (uint32_t)node.cpus.size();
+	}
+	return count;
+}
+
+const NumaTopology& NumaTopology::Get()
+{
+	static const NumaTopology topology = Detect();
+	return topology;
+}
+
+#ifdef WL_PLATFORM_WINDOWS
+
+NumaTopology NumaTopology::Detect()
+{
+	NumaTopology topology;
+
+	ULONG highestNode = 0;
+	if (GetNumaHighestNodeNumber(&highestNode))
+	{
+		for (ULONG id = 0; id <= highestNode; id++)
+		{
+			GROUP_AFFINITY affinity;
+			if (!GetNumaNodeProcessorMaskEx((USHORT)id, &affinity) || affinity.Mask == 0)
+				continue;
+
+			Node node;
+			node.id = id;
+			for (uint32_t bit = 0; bit < 64; bit++)
+			{
+				if (affinity.Mask & ((KAFFINITY)1 << bit))
+					node.cpus.push_back(affinity.Group * 64 + bit);
+			}
+			topology.nodes.push_back(std::move(node));
+		}
+	}
+
+	if (topology.nodes.empty())
+	{
+		Node node{ 0, {} };
+		for (uint32_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++)
+			node.cpus.push_back(cpu);
+		topology.nodes.push_back(std::move(node));
+	}
+	return topology;
+}
+
+bool NumaTopology::PinCurrentThread(uint32_t cpu)
+{
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = (WORD)(cpu / 64);
+	affinity.Mask = (KAFFINITY)1 << (cpu % 64);
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+#else
+
+namespace {
+	// the kernel writes cpu lists like "0-11,24-35"
+	std::vector<uint32_t> ParseCpuList(const std::string& list)
+	{
+		std::vector<uint32_t> cpus;
+		std::istringstream stream(list);
+		std::string range;
+		while (std::getline(stream, range, ','))
+		{
+			unsigned first, last;
+			int count = sscanf(range.c_str(), "%u-%u", &first, &last);
+			if (count == 1)
+				last = first;
+			else if (count != 2)
+				continue;
+
+			for (unsigned cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+		}
+		return cpus;
+	}
+}
+
+NumaTopology NumaTopology::Detect()
+{
+	NumaTopology topology;
+
+	// only the CPUs this process may run on, e.g. inside a container or after taskset
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	for (uint32_t id = 0; ; id++)
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+		if (!file)
+		{
+			// the node numbers can have gaps, but never many of them
+			if (id > 64)
+				break;
+			continue;
+		}
+
+		std::string list;
+		std::getline(file, list);
+
+		Node node{ id, {} };
+		for (uint32_t cpu : ParseCpuList(list))
+		{
+			if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+				node.cpus.push_back(cpu);
+		}
+		if (!node.cpus.empty())
+			topology.nodes.push_back(std::move(node));
+	}
+
+	if (topology.nodes.empty())
+	{
+		Node node{ 0, {} };
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (restricted ? CPU_ISSET(cpu, &allowed) : cpu < std::thread::hardware_concurrency())
+				node.cpus.push_back(cpu);
+		}
+		topology.nodes.push_back(std::move(node));
+	}
+	return topology;
+}
+
+bool NumaTopology::PinCurrentThread(uint32_t cpu)
+{
+	if (cpu >= CPU_SETSIZE)
+		return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// the NUMA nodes of the machine and the logical CPUs belonging to each of them.
+// a machine without NUMA (or where it can not be detected) is one node with all CPUs
+struct NumaTopology
+{
+	struct Node
+	{
+		uint32_t id;
+		std::vector<uint32_t> cpus; // on windows group * 64 + number inside the group
+	};
+
+	std::vector<Node> nodes;
+
+	uint32_t GetCpuCount() const;
+
+	// detected once, the topology does not change while the program runs
+	static const NumaTopology& Get();
+
+	// pins the calling thread to one logical CPU, false if the system does not allow it
+	static bool PinCurrentThread(uint32_t cpu);
+private:
+	static NumaTopology Detect();
+};
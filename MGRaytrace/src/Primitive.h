@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <cstdint>
+#include <vector>
+
+enum class PrimitiveType : uint32_t
+{
+	Sphere = 0,
+	Cube,
+	Count
+};
+
+// a primitive id packs the type into the top bit and the index into Scene::Spheres or
+// Scene::Cubes into the other 31, so a hit only has to carry one 32 bit number
+namespace PrimitiveId {
+
+	constexpr uint32_t TypeShift = 31;
+	constexpr uint32_t IndexMask = (1u << TypeShift) - 1;
+	constexpr uint32_t Invalid = 0xFFFFFFFF;
+
+	inline uint32_t Make(PrimitiveType type, uint32_t index) { return ((uint32_t)type << TypeShift) | index; }
+	inline PrimitiveType Type(uint32_t id) { return (PrimitiveType)(id >> TypeShift); }
+	inline uint32_t Index(uint32_t id) { return id & IndexMask; }
+}
+
+// all primitives of a scene in one list, sorted by type so every type is one range which is
+// tested with its own intersection function. the BVH numbers the primitives in the same order,
+// a BVH primitive number is an index into ids
+struct PrimitiveTable
+{
+	std::vector<uint32_t> ids;
+	uint32_t rangeEnd[(int)PrimitiveType::Count] = {}; // the range of a type starts where the one before ends
+
+	uint32_t RangeBegin(PrimitiveType type) const { return type == PrimitiveType::Sphere ? 0 : rangeEnd[(int)type - 1]; }
+	uint32_t RangeEnd(PrimitiveType type) const { return rangeEnd[(int)type]; }
+
+	void Build(const Scene& scene)
+	{
+		ids.clear();
+		ids.reserve(scene.Spheres.size() + scene.Cubes.size());
+
+		for (uint32_t i = 0; i < (uint32_t)scene.Spheres.size(); i++)
+			ids.push_back(PrimitiveId::Make(PrimitiveType::Sphere, i));
+		rangeEnd[(int)PrimitiveType::Sphere] = (uint32_t)ids.size();
+
+		for (uint32_t i = 0; i < (uint32_t)scene.Cubes.size(); i++)
+			ids.push_back(PrimitiveId::Make(PrimitiveType::Cube, i));
+		rangeEnd[(int)PrimitiveType::Cube] = (uint32_t)ids.size();
+	}
+
+	bool Matches(const Scene& scene) const
+	{
+		return rangeEnd[(int)PrimitiveType::Sphere] == scene.Spheres.size()
+			&& ids.size() == scene.Spheres.size() + scene.Cubes.size();
+	}
+};
@@ -0,0 +1,338 @@
+#include "RenderCoordinator.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef WL_PLATFORM_WINDOWS
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+RenderCoordinator::RenderCoordinator(const CoordinatorSettings& settings)
+	: m_Settings(settings)
+{
+}
+
+RenderCoordinator::~RenderCoordinator()
+{
+	StopWorkers();
+}
+
+bool RenderCoordinator::Run(std::string& error)
+{
+	const RenderJob& job = m_Settings.job;
+	Walnut::Timer timer;
+
+	// every tile gets one unit per range of samples
+	uint32_t tileSize = job.tileSize;
+	uint32_t chunkCount = (job.samplesPerPixel + SamplesPerUnit - 1) / SamplesPerUnit;
+	for (uint32_t y = 0; y < job.height; y += tileSize)
+	{
+		for (uint32_t x = 0; x < job.width; x += tileSize)
+		{
+			TileState tile;
+			tile.x = x;
+			tile.y = y;
+			tile.width = std::min(tileSize, job.width - x);
+			tile.height = std::min(tileSize, job.height - y);
+			tile.sums.assign((size_t)tile.width * tile.height, glm::vec4(0.0f));
+			m_Tiles.push_back(std::move(tile));
+		}
+	}
+	for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+	{
+		for (uint32_t tile = 0; tile < (uint32_t)m_Tiles.size(); tile++)
+		{
+			m_Units.push_back({ tile, chunk });
+			m_Queue.push_back((uint32_t)m_Units.size() - 1);
+		}
+	}
+	m_Remaining = (uint32_t)m_Units.size();
+
+#ifdef WL_PLATFORM_WINDOWS
+	// every process id has its own range of ports for the local workers, more workers would use the range of the next one
+	if (m_Settings.localWorkers > LocalPortsPerProcess)
+	{
+		error = "at most " + std::to_string(LocalPortsPerProcess) + " local workers are supported on windows, use --connect for more";
+		return false;
+	}
+#endif
+
+	for (uint32_t i = 0; i < m_Settings.localWorkers; i++)
+	{
+		auto worker = std::make_unique<Worker>();
+		worker->local = true;
+#ifdef WL_PLATFORM_WINDOWS
+		worker->address = "tcp:" + std::to_string(40000 + (getpid() % 2000) * LocalPortsPerProcess + i);
+		std::string command = "\"\"" + m_Settings.executable + "\" --server " + worker->address + " > NUL\"";
+#else
+		worker->address = "unix:/tmp/mgraytrace-" + std::to_string(getpid()) + "-" + std::to_string(i) + ".sock";
+		std::string command = "\"" + m_Settings.executable + "\" --server " + worker->address + " > /dev/null";
+#endif
+		// system() blocks until the worker quits, so it gets a thread of its own
+		worker->process = std::thread([command] { std::system(command.c_str()); });
+		m_Workers.push_back(std::move(worker));
+	}
+	for (const std::string& address : m_Settings.remoteWorkers)
+	{
+		auto worker = std::make_unique<Worker>();
+		worker->address = address;
+		m_Workers.push_back(std::move(worker));
+	}
+
+	if (m_Workers.empty())
+	{
+		error = "there are no workers";
+		return false;
+	}
+
+	for (auto& worker : m_Workers)
+	{
+		worker->thread = std::thread(&RenderCoordinator::WorkerLoop, this, std::ref(*worker));
+	}
+	for (auto& worker : m_Workers)
+	{
+		worker->thread.join();
+	}
+
+	bool finished = m_Remaining == 0;
+	if (!finished && m_Error.empty())
+		m_Error = "all workers went away before the image was done";
+
+	for (const auto& worker : m_Workers)
+	{
+		printf("%s rendered %u of %u units\n", worker->address.c_str(), worker->unitsDone, (uint32_t)m_Units.size());
+	}
+	StopWorkers();
+
+	if (!finished)
+	{
+		error = m_Error;
+		return false;
+	}
+
+	// put the tiles together and divide by the number of samples each of them got
+	m_Image.assign((size_t)job.width * job.height, glm::vec4(0.0f));
+	for (const TileState& tile : m_Tiles)
+	{
+		float invSamples = 1.0f / (float)tile.samples;
+		for (uint32_t y = 0; y < tile.height; y++)
+		{
+			for (uint32_t x = 0; x < tile.width; x++)
+			{
+				m_Image[(tile.x + x) + (tile.y + y) * job.width] = tile.sums[x + y * tile.width] * invSamples;
+			}
+		}
+	}
+
+	printf("rendered %u units on %u workers in %.1f s\n", (uint32_t)m_Units.size(), (uint32_t)m_Workers.size(), timer.Elapsed());
+	return true;
+}
+
+void RenderCoordinator::WorkerLoop(Worker& worker)
+{
+	// a subprocess needs a moment until it listens
+	std::string error;
+	for (int attempt = 0; !worker.socket.Connect(worker.address, error); attempt++)
+	{
+		if (!worker.local || attempt >= 100)
+		{
+			fprintf(stderr, "worker %s: %s\n", worker.address.c_str(), error.c_str());
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	std::vector<uint32_t> inFlight;
+	std::vector<glm::vec4> sums;
+	std::string line;
+
+	while (true)
+	{
+		uint32_t unit;
+		while (inFlight.size() < UnitsInFlight && TakeUnit(inFlight, unit))
+		{
+			const TileState& tile = m_Tiles[m_Units[unit].tile];
+			uint32_t chunk = m_Units[unit].chunk;
+
+			RenderJob job = m_Settings.job;
+			job.id = unit;
+			job.regionX = tile.x;
+			job.regionY = tile.y;
+			job.regionWidth = tile.width;
+			job.regionHeight = tile.height;
+			job.tileSize = std::max(tile.width, tile.height);
+			job.firstSample = 1 + chunk * SamplesPerUnit;
+			job.samplesPerPixel = std::min(SamplesPerUnit, m_Settings.job.samplesPerPixel - chunk * SamplesPerUnit);
+			job.sums = true;
+
+			inFlight.push_back(unit);
+			if (!worker.socket.SendLine(RenderProtocol::FormatJob(job)))
+				break;
+		}
+
+		if (inFlight.empty())
+			break;
+
+		if (!worker.socket.ReceiveLine(line))
+			break;
+
+		TileHeader tile;
+		if (RenderProtocol::ParseTile(line, sizeof(glm::vec4), tile))
+		{
+			sums.resize((size_t)tile.width * tile.height);
+			auto position = std::find(inFlight.begin(), inFlight.end(), tile.jobId);
+			if (position == inFlight.end() || !worker.socket.Receive(sums.data(), tile.bytes))
+				break;
+
+			// the sums are added to the tile of the unit pixel by pixel, they have to cover exactly that tile
+			const TileState& expected = m_Tiles[m_Units[tile.jobId].tile];
+			if (tile.x != expected.x || tile.y != expected.y || tile.width != expected.width || tile.height != expected.height)
+				break;
+
+			inFlight.erase(position);
+			AddResult(tile.jobId, std::move(sums), worker);
+		}
+		else if (line.rfind("tile", 0) == 0)
+		{
+			break; // the pixels do not fit the header, the rest of the stream can not be read
+		}
+		else if (line.rfind("error", 0) == 0)
+		{
+			// the same job would fail on every worker, e.g. a scene file which does not exist
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Error.empty())
+				m_Error = worker.address + ": " + line;
+			m_Queue.clear();
+			break;
+		}
+	}
+
+	// whatever this worker did not finish goes to the others
+	ReturnUnits(inFlight);
+}
+
+bool RenderCoordinator::TakeUnit(const std::vector<uint32_t>& inFlight, uint32_t& unit)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Error.empty())
+		return false;
+
+	while (!m_Queue.empty())
+	{
+		unit = m_Queue.front();
+		m_Queue.pop_front();
+		if (!m_Units[unit].done)
+		{
+			m_Units[unit].inFlight++;
+			return true;
+		}
+	}
+
+	// nothing left, help with a unit another worker is still busy with.
+	// the oldest one first, it is the most likely to belong to a worker that fell behind
+	for (uint32_t i = 0; i < (uint32_t)m_Units.size(); i++)
+	{
+		WorkUnit& candidate = m_Units[i];
+		if (!candidate.done && candidate.inFlight == 1 && std::find(inFlight.begin(), inFlight.end(), i) == inFlight.end())
+		{
+			candidate.inFlight++;
+			unit = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void RenderCoordinator::ReturnUnits(const std::vector<uint32_t>& units)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (uint32_t unit : units)
+	{
+		m_Units[unit].inFlight--;
+		if (!m_Units[unit].done && m_Units[unit].inFlight == 0 && m_Error.empty())
+			m_Queue.push_front(unit);
+	}
+}
+
+void RenderCoordinator::AddResult(uint32_t unit, std::vector<glm::vec4>&& sums, Worker& worker)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	WorkUnit& work = m_Units[unit];
+	work.inFlight--;
+	if (work.done)
+		return; // another worker was faster, both results are the same
+
+	work.done = true;
+	m_Remaining--;
+	worker.unitsDone++;
+
+	// the chunks of a tile are added in their order, later ones wait for the missing ones
+	TileState& tile = m_Tiles[work.tile];
+	tile.waiting[work.chunk] = std::move(sums);
+	for (auto next = tile.waiting.find(tile.nextChunk); next != tile.waiting.end(); next = tile.waiting.find(tile.nextChunk))
+	{
+		for (size_t i = 0; i < tile.sums.size(); i++)
+		{
+			tile.sums[i] += next->second[i];
+		}
+		tile.samples += std::min(SamplesPerUnit, m_Settings.job.samplesPerPixel - tile.nextChunk * SamplesPerUnit);
+		tile.waiting.erase(next);
+		tile.nextChunk++;
+	}
+
+	// once everything is done the workers which still render a duplicate are woken up
+	if (m_Remaining == 0)
+	{
+		for (auto& other : m_Workers)
+		{
+			other->socket.Shutdown();
+		}
+	}
+}
+
+void RenderCoordinator::StopWorkers()
+{
+	for (auto& worker : m_Workers)
+	{
+		if (worker->local && worker->process.joinable())
+		{
+			Socket socket;
+			std::string error;
+			if (socket.Connect(worker->address, error))
+				socket.SendLine("quit");
+			worker->process.join();
+		}
+	}
+}
+
+bool RenderCoordinator::WritePPM(const std::string& path) const
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	const RenderJob& job = m_Settings.job;
+	fprintf(file, "P6\n%u %u\n255\n", job.width, job.height);
+
+	// the renderer starts with the bottom row, PPM with the top one
+	std::vector<uint8_t> row((size_t)job.width * 3);
+	for (uint32_t y = job.height; y-- > 0;)
+	{
+		for (uint32_t x = 0; x < job.width; x++)
+		{
+			glm::vec4 color = glm::clamp(m_Image[x + y * job.width], glm::vec4(0.0f), glm::vec4(1.0f));
+			row[x * 3 + 0] = (uint8_t)(color.r * 255.0f);
+			row[x * 3 + 1] = (uint8_t)(color.g * 255.0f);
+			row[x * 3 + 2] = (uint8_t)(color.b * 255.0f);
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	return fclose(file) == 0;
+}
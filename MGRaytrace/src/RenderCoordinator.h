@@ -0,0 +1,96 @@
+#pragma once
+
+#include "RenderProtocol.h"
+#include "Socket.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CoordinatorSettings
+{
+	RenderJob job;						// the whole image, region, tile, first and format are set per work unit
+	uint32_t localWorkers = 2;			// render servers started as subprocesses of this program
+	std::vector<std::string> remoteWorkers;	// addresses of render servers which are already running
+	std::string executable;				// this program, used to start the local workers
+};
+
+// splits one image into work units of one tile and a fixed range of samples and spreads
+// them over several render servers (RenderServer), local subprocesses or remote ones.
+//
+// every worker takes the next unit as soon as it has room, so a fast worker simply does more
+// of them. when no unit is left, idle workers also render the units a slower worker is still
+// busy with and the first result wins. units of a worker which goes away are given to the others.
+//
+// the sums of a tile are always added up in the order of their sample ranges, no matter which
+// worker sent them when. with a fixed size of the ranges the image is exactly the same for
+// any number of workers and any order of the results
+class RenderCoordinator
+{
+public:
+	explicit RenderCoordinator(const CoordinatorSettings& settings);
+	~RenderCoordinator();
+
+	bool Run(std::string& error);
+
+	// the average of all samples, bottom row first
+	const std::vector<glm::vec4>& GetImage() const { return m_Image; }
+	bool WritePPM(const std::string& path) const;
+private:
+	struct WorkUnit
+	{
+		uint32_t tile;
+		uint32_t chunk;		// which range of samples
+		bool done = false;
+		uint32_t inFlight = 0;	// how many workers render it right now
+	};
+
+	struct TileState
+	{
+		uint32_t x, y, width, height;
+		std::vector<glm::vec4> sums;
+		uint32_t samples = 0;
+		uint32_t nextChunk = 0;	// the chunk which has to be added next
+		std::map<uint32_t, std::vector<glm::vec4>> waiting; // chunks which arrived too early
+	};
+
+	struct Worker
+	{
+		std::string address;
+		Socket socket;
+		std::thread thread;
+		std::thread process;	// waits for a local subprocess
+		uint32_t unitsDone = 0;
+		bool local = false;
+	};
+
+	void WorkerLoop(Worker& worker);
+	bool TakeUnit(const std::vector<uint32_t>& inFlight, uint32_t& unit);
+	void ReturnUnits(const std::vector<uint32_t>& units);
+	void AddResult(uint32_t unit, std::vector<glm::vec4>&& sums, Worker& worker);
+	void StopWorkers();
+private:
+	// a fixed size keeps the order of the additions the same for every split of the work
+	static constexpr uint32_t SamplesPerUnit = 16;
+	static constexpr size_t UnitsInFlight = 2; // per worker, the next unit is ready when one finishes
+	// windows has no unix sockets, the local workers listen on tcp ports derived from the process id
+	static constexpr uint32_t LocalPortsPerProcess = 8;
+
+	CoordinatorSettings m_Settings;
+
+	std::mutex m_Mutex;
+	std::vector<WorkUnit> m_Units;
+	std::deque<uint32_t> m_Queue;	// units no worker took yet
+	uint32_t m_Remaining = 0;
+	std::vector<TileState> m_Tiles;
+	std::string m_Error;
+
+	std::vector<std::unique_ptr<Worker>> m_Workers;
+	std::vector<glm::vec4> m_Image;
+};
@@ -0,0 +1,99 @@
+#include "RenderProtocol.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+std::string RenderProtocol::FormatJob(const RenderJob& job)
+{
+	std::ostringstream line;
+	line.precision(9); // enough digits that the floats arrive unchanged
+	line << "job id=" << job.id
+		<< " scene=" << job.scene
+		<< " camera=" << job.position.x << "," << job.position.y << "," << job.position.z
+		<< "," << job.forward.x << "," << job.forward.y << "," << job.forward.z
+		<< " size=" << job.width << "x" << job.height
+		<< " spp=" << job.samplesPerPixel
+		<< " region=" << job.regionX << "," << job.regionY << "," << job.regionWidth << "," << job.regionHeight
+		<< " tile=" << job.tileSize
+		<< " seed=" << job.seed
+		<< " first=" << job.firstSample
+		<< " format=" << (job.sums ? "sums" : "rgba8");
+	return line.str();
+}
+
+bool RenderProtocol::ParseJob(const std::string& line, RenderJob& job, std::string& error)
+{
+	std::istringstream stream(line);
+	std::string word;
+	if (!(stream >> word) || word != "job")
+	{
+		error = "not a job: " + line;
+		return false;
+	}
+
+	while (stream >> word)
+	{
+		size_t equals = word.find('=');
+		if (equals == std::string::npos)
+		{
+			error = "expected key=value instead of " + word;
+			return false;
+		}
+		std::string key = word.substr(0, equals);
+		const char* value = word.c_str() + equals + 1;
+
+		bool ok;
+		if (key == "id")
+			ok = sscanf(value, "%u", &job.id) == 1;
+		else if (key == "scene")
+			ok = !(job.scene = value).empty();
+		else if (key == "camera")
+			ok = sscanf(value, "%f,%f,%f,%f,%f,%f", &job.position.x, &job.position.y, &job.position.z,
+				&job.forward.x, &job.forward.y, &job.forward.z) == 6;
+		else if (key == "size")
+			ok = sscanf(value, "%ux%u", &job.width, &job.height) == 2 && job.width > 0 && job.height > 0;
+		else if (key == "spp")
+			ok = sscanf(value, "%u", &job.samplesPerPixel) == 1 && job.samplesPerPixel > 0;
+		else if (key == "region")
+			ok = sscanf(value, "%u,%u,%u,%u", &job.regionX, &job.regionY, &job.regionWidth, &job.regionHeight) == 4;
+		else if (key == "tile")
+			ok = sscanf(value, "%u", &job.tileSize) == 1 && job.tileSize > 0;
+		else if (key == "seed")
+			ok = sscanf(value, "%u", &job.seed) == 1;
+		else if (key == "first")
+			ok = sscanf(value, "%u", &job.firstSample) == 1 && job.firstSample > 0;
+		else if (key == "format")
+			ok = (job.sums = strcmp(value, "sums") == 0) || strcmp(value, "rgba8") == 0;
+		else
+		{
+			error = "unknown key " + key;
+			return false;
+		}
+
+		if (!ok)
+		{
+			error = "invalid value for " + key + ": " + value;
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string RenderProtocol::FormatTile(const TileHeader& tile)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "tile %u %u %u %u %u %u %u",
+		tile.jobId, tile.x, tile.y, tile.width, tile.height, tile.samples, tile.bytes);
+	return line;
+}
+
+bool RenderProtocol::ParseTile(const std::string& line, uint32_t bytesPerPixel, TileHeader& tile)
+{
+	if (sscanf(line.c_str(), "tile %u %u %u %u %u %u %u",
+		&tile.jobId, &tile.x, &tile.y, &tile.width, &tile.height, &tile.samples, &tile.bytes) != 7)
+		return false;
+
+	// the receiver sizes its buffer from width and height, the bytes which follow have to fit exactly
+	return (uint64_t)tile.width * tile.height * bytesPerPixel == tile.bytes;
+}
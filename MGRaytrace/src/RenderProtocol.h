@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+
+// the text protocol between render clients and a render server (RenderServer).
+// the client sends one request per line:
+//   job id=<n> scene=<name> camera=<px>,<py>,<pz>,<fx>,<fy>,<fz> size=<w>x<h> spp=<n> region=<x>,<y>,<w>,<h> tile=<n> seed=<n>
+//       first=<n> format=rgba8|sums
+//   quit
+// every key of a job is optional. the scene is "default", "bounce" or the path of a scene file.
+// first is the number of the first sample (counted from 1), so a pixel can be split into several jobs.
+// the server answers a job with its tiles as soon as each one is done, then with done or error:
+//   tile <id> <x> <y> <w> <h> <samples> <bytes>     followed by <bytes> of pixels, bottom row first
+// the pixels are RGBA8, or for format=sums the unaveraged sums of all samples as four floats
+// in the byte order of the server (needed to merge the tiles of several servers)
+//   done <id> <milliseconds>
+//   error <id> <message>
+struct RenderJob
+{
+	uint32_t id = 0;
+	std::string scene = "default";
+	glm::vec3 position{ 0.0f, 0.0f, 6.0f };
+	glm::vec3 forward{ 0.0f, 0.0f, -1.0f };
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t samplesPerPixel = 16;
+	uint32_t regionX = 0, regionY = 0;
+	uint32_t regionWidth = 0, regionHeight = 0; // 0 means up to the edge of the image
+	uint32_t tileSize = 64;
+	uint32_t seed = 0;
+	uint32_t firstSample = 1;
+	bool sums = false;
+};
+
+struct TileHeader
+{
+	uint32_t jobId = 0;
+	uint32_t x = 0, y = 0;
+	uint32_t width = 0, height = 0;
+	uint32_t samples = 0;
+	uint32_t bytes = 0;
+};
+
+namespace RenderProtocol {
+
+	std::string FormatJob(const RenderJob& job);
+	bool ParseJob(const std::string& line, RenderJob& job, std::string& error);
+
+	std::string FormatTile(const TileHeader& tile);
+	// false for other lines and for a tile whose bytes are not width * height * bytesPerPixel
+	// (4 for rgba8, 16 for sums), the pixels of such a tile must not be received
+	bool ParseTile(const std::string& line, uint32_t bytesPerPixel, TileHeader& tile);
+}
@@ -0,0 +1,275 @@
+#include "RenderServer.h"
+
+#include "SceneLoader.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+
+bool RenderServer::Run(const std::string& address, std::string& error)
+{
+	if (!m_Listener.Listen(address, error))
+		return false;
+
+	m_Address = address;
+	m_Stopping = false;
+	printf("render server listening on %s\n", address.c_str());
+
+	std::thread renderThread(&RenderServer::RenderLoop, this);
+
+	while (!m_Stopping)
+	{
+		Socket client = m_Listener.Accept();
+		if (m_Stopping || !client.IsOpen())
+			break;
+
+		auto connection = std::make_shared<Connection>();
+		connection->socket = std::move(client);
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// clean up after clients which are gone, their threads have ended already
+		for (auto it = m_Connections.begin(); it != m_Connections.end();)
+		{
+			if (it->connection->finished)
+			{
+				it->thread.join();
+				it = m_Connections.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		m_Connections.push_back({ connection, std::thread(&RenderServer::HandleConnection, this, connection) });
+	}
+
+	Stop();
+	renderThread.join();
+
+	// wake up every connection thread which still waits for a request
+	std::vector<ConnectionThread> connections;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		connections = std::move(m_Connections);
+	}
+	for (ConnectionThread& connection : connections)
+	{
+		connection.connection->socket.Shutdown();
+		connection.thread.join();
+	}
+
+	m_Listener.Close();
+	printf("render server stopped\n");
+	return true;
+}
+
+void RenderServer::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Stopping.exchange(true))
+			return;
+	}
+	m_JobAdded.notify_all();
+
+	// Accept has no timeout, a connection of our own wakes it up on every platform
+	std::string error;
+	Socket wakeup;
+	wakeup.Connect(m_Address, error);
+}
+
+void RenderServer::HandleConnection(std::shared_ptr<Connection> connection)
+{
+	std::string line;
+	while (!m_Stopping && connection->socket.ReceiveLine(line))
+	{
+		if (line.empty())
+			continue;
+
+		if (line == "quit")
+		{
+			Stop();
+			break;
+		}
+
+		RenderJob job;
+		std::string error;
+		if (!RenderProtocol::ParseJob(line, job, error))
+		{
+			Send(*connection, "error " + std::to_string(job.id) + " " + error);
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Queue.push_back({ connection, job });
+		}
+		m_JobAdded.notify_one();
+	}
+
+	// queued jobs of this client are skipped from now on
+	connection->open = false;
+	connection->finished = true;
+}
+
+void RenderServer::RenderLoop()
+{
+	while (true)
+	{
+		QueuedJob next;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_JobAdded.wait(lock, [this] { return !m_Queue.empty() || m_Stopping; });
+			if (m_Stopping)
+				return;
+
+			// jobs which share the scene of the last one go first, everything else keeps its order
+			auto job = std::find_if(m_Queue.begin(), m_Queue.end(),
+				[this](const QueuedJob& queued) { return queued.job.scene == m_LastScene; });
+			if (job == m_Queue.end())
+				job = m_Queue.begin();
+
+			next = std::move(*job);
+			m_Queue.erase(job);
+		}
+
+		if (next.connection->open)
+		{
+			RenderJobTiles(*next.connection, next.job);
+		}
+	}
+}
+
+RenderServer::CachedScene* RenderServer::GetScene(const std::string& name, std::string& error)
+{
+	m_UseCounter++;
+	for (auto& cached : m_Scenes)
+	{
+		if (cached->name == name)
+		{
+			cached->lastUse = m_UseCounter;
+			return cached.get();
+		}
+	}
+
+	auto cached = std::make_unique<CachedScene>();
+	cached->name = name;
+	if (!SceneLoader::LoadByName(name, cached->scene, error))
+		return nullptr;
+
+	cached->renderer = std::make_unique<Renderer>(true);
+	cached->renderer->GetSettings().MemoryBudgetMB = m_MemoryBudgetMB > 0 ? std::max<uint32_t>(m_MemoryBudgetMB / MaxCachedScenes, 1) : 0;
+	cached->lastUse = m_UseCounter;
+
+	// the scene which was not used for the longest time makes room
+	if (m_Scenes.size() >= MaxCachedScenes)
+	{
+		auto oldest = std::min_element(m_Scenes.begin(), m_Scenes.end(),
+			[](const auto& a, const auto& b) { return a->lastUse < b->lastUse; });
+		m_Scenes.erase(oldest);
+	}
+
+	m_Scenes.push_back(std::move(cached));
+	return m_Scenes.back().get();
+}
+
+void RenderServer::RenderJobTiles(Connection& connection, const RenderJob& job)
+{
+	Walnut::Timer timer;
+	std::string jobId = std::to_string(job.id);
+
+	std::string error;
+	CachedScene* cached = GetScene(job.scene, error);
+	if (!cached)
+	{
+		Send(connection, "error " + jobId + " " + error);
+		return;
+	}
+	m_LastScene = job.scene;
+
+	if (job.regionX >= job.width || job.regionY >= job.height)
+	{
+		Send(connection, "error " + jobId + " the region is outside of the image");
+		return;
+	}
+	uint32_t regionWidth = job.regionWidth ? std::min(job.regionWidth, job.width - job.regionX) : job.width - job.regionX;
+	uint32_t regionHeight = job.regionHeight ? std::min(job.regionHeight, job.height - job.regionY) : job.height - job.regionY;
+
+	Renderer& renderer = *cached->renderer;
+	renderer.onResize(job.width, job.height);
+	renderer.SetRunSeed(job.seed);
+
+	// the renderers share the camera, it keeps the ray cache only while the current one has room for it
+	m_Camera.SetRayDirectionCache(renderer.WantsRayDirectionCache());
+
+	if (!m_CameraValid || m_CameraJob.width != job.width || m_CameraJob.height != job.height
+		|| m_CameraJob.position != job.position || m_CameraJob.forward != job.forward)
+	{
+		m_Camera.OnResize(job.width, job.height);
+		m_Camera.SetView(job.position, job.forward);
+		m_CameraJob = job;
+		m_CameraValid = true;
+	}
+
+	std::vector<glm::vec4> sums;
+	std::vector<uint32_t> pixels;
+
+	for (uint32_t tileY = job.regionY; tileY < job.regionY + regionHeight; tileY += job.tileSize)
+	{
+		for (uint32_t tileX = job.regionX; tileX < job.regionX + regionWidth; tileX += job.tileSize)
+		{
+			// the client went away, the rest of the job is of no use
+			if (!connection.open || m_Stopping)
+				return;
+
+			TileHeader tile;
+			tile.jobId = job.id;
+			tile.x = tileX;
+			tile.y = tileY;
+			tile.width = std::min(job.tileSize, job.regionX + regionWidth - tileX);
+			tile.height = std::min(job.tileSize, job.regionY + regionHeight - tileY);
+			tile.samples = job.samplesPerPixel;
+
+			sums.assign((size_t)tile.width * tile.height, glm::vec4(0.0f));
+			renderer.RenderRegion(cached->scene, m_Camera, tile.x, tile.y, tile.width, tile.height, job.firstSample, job.samplesPerPixel, sums.data());
+
+			if (job.sums)
+			{
+				tile.bytes = (uint32_t)(sums.size() * sizeof(glm::vec4));
+				if (!Send(connection, RenderProtocol::FormatTile(tile), sums.data(), tile.bytes))
+				{
+					connection.open = false;
+					return;
+				}
+				continue;
+			}
+
+			pixels.resize(sums.size());
+			for (size_t i = 0; i < sums.size(); i++)
+			{
+				glm::vec4 color = glm::clamp(sums[i] / (float)job.samplesPerPixel, glm::vec4(0.0f), glm::vec4(1.0f));
+				pixels[i] = ((uint32_t)(uint8_t)(color.a * 255.0f) << 24) | ((uint32_t)(uint8_t)(color.b * 255.0f) << 16)
+					| ((uint32_t)(uint8_t)(color.g * 255.0f) << 8) | (uint32_t)(uint8_t)(color.r * 255.0f);
+			}
+			tile.bytes = (uint32_t)(pixels.size() * sizeof(uint32_t));
+
+			if (!Send(connection, RenderProtocol::FormatTile(tile), pixels.data(), tile.bytes))
+			{
+				connection.open = false;
+				return;
+			}
+		}
+	}
+
+	char done[64];
+	snprintf(done, sizeof(done), "done %u %.1f", job.id, timer.ElapsedMillis());
+	Send(connection, done);
+}
+
+bool RenderServer::Send(Connection& connection, const std::string& line, const void* data, size_t size)
+{
+	std::lock_guard<std::mutex> lock(connection.sendMutex);
+	return connection.socket.SendLine(line) && (size == 0 || connection.socket.Send(data, size));
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "RenderProtocol.h"
+#include "Scene.h"
+#include "Socket.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// keeps renderers and their scenes in memory and renders jobs sent over a socket (see RenderProtocol.h).
+//
+// every client connection has its own thread which only reads requests into one queue,
+// the rendering itself happens on a single thread which spreads every tile over all cores.
+// jobs for the scene that was rendered last are taken first, and every cached scene keeps
+// its own renderer, so the BVH of a scene is only built once as long as it stays in the cache
+class RenderServer
+{
+public:
+	// blocks until a client sends quit
+	bool Run(const std::string& address, std::string& error);
+
+	// megabytes for all cached renderers together, every one gets an equal share. 0 is unlimited
+	void SetMemoryBudget(uint32_t megabytes) { m_MemoryBudgetMB = megabytes; }
+private:
+	struct Connection
+	{
+		Socket socket;
+		std::mutex sendMutex; // a tile and its pixels must not be split by another message
+		std::atomic<bool> open{ true };
+		std::atomic<bool> finished{ false }; // the thread reading the requests has ended
+	};
+
+	struct ConnectionThread
+	{
+		std::shared_ptr<Connection> connection;
+		std::thread thread;
+	};
+
+	struct QueuedJob
+	{
+		std::shared_ptr<Connection> connection;
+		RenderJob job;
+	};
+
+	struct CachedScene
+	{
+		std::string name;
+		Scene scene;
+		std::unique_ptr<Renderer> renderer;
+		uint64_t lastUse = 0;
+	};
+
+	void HandleConnection(std::shared_ptr<Connection> connection);
+	void RenderLoop();
+	void RenderJobTiles(Connection& connection, const RenderJob& job);
+	CachedScene* GetScene(const std::string& name, std::string& error);
+	void Stop();
+
+	static bool Send(Connection& connection, const std::string& line, const void* data = nullptr, size_t size = 0);
+private:
+	static constexpr size_t MaxCachedScenes = 4;
+
+	std::string m_Address;
+	Socket m_Listener;
+	std::atomic<bool> m_Stopping{ false };
+
+	std::mutex m_Mutex;
+	std::condition_variable m_JobAdded;
+	std::deque<QueuedJob> m_Queue;
+	std::vector<ConnectionThread> m_Connections;
+
+	std::vector<std::unique_ptr<CachedScene>> m_Scenes;
+	std::string m_LastScene;
+	uint64_t m_UseCounter = 0;
+	uint32_t m_MemoryBudgetMB = 0;
+
+	// the camera of the last job, it only has to be recalculated when the next job moves it
+	Camera m_Camera{ 45.0f, 0.1f, 100.0f };
+	RenderJob m_CameraJob;
+	bool m_CameraValid = false;
+};
@@ -1,8 +1,18 @@
 #include "Renderer.h"
 
+#include "EnvironmentMap.h"
+#include "Intersection.h"
+
 #include "Walnut/Random.h"
+#include "Walnut/Timer.h"
 
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cstring>
 #include <execution>
+#include <numeric>
+#include <random>
+#include <thread>
 
 namespace Utils {
 	static uint32_t ConvertToRGBA(const glm::vec4& color)
@@ -17,106 +27,557 @@ namespace Utils {
 		uint32_t res = (a << 24) | (b << 16) | (g << 8) | r;
 		return res;
 	}
+
+	// a cheap hash with good distribution, used as random number generator:
+	// every call hashes the state again (PCG by Jarzynski and Olano)
+	static uint32_t PCG_Hash(uint32_t input)
+	{
+		uint32_t state = input * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	static float RandomFloat(uint32_t& seed)
+	{
+		seed = PCG_Hash(seed);
+		return (float)seed / (float)std::numeric_limits<uint32_t>::max();
+	}
+
+	// same distribution as Walnut::Random::InUnitSphere: a random point of the cube, normalized
+	static glm::vec3 InUnitSphere(uint32_t& seed)
+	{
+		return glm::normalize(glm::vec3(
+			RandomFloat(seed) * 2.0f - 1.0f,
+			RandomFloat(seed) * 2.0f - 1.0f,
+			RandomFloat(seed) * 2.0f - 1.0f));
+	}
+
+	// maps a uniform number to an offset in -1 .. 1 distributed like the tent filter 1 - |x|
+	static float SampleTent(float u)
+	{
+		return u < 0.5f ? glm::sqrt(2.0f * u) - 1.0f : 1.0f - glm::sqrt(2.0f - 2.0f * u);
+	}
+
+	// balances two ways of sampling the same light, the one with the higher pdf gets more weight
+	static float PowerHeuristic(float pdf, float otherPdf)
+	{
+		float square = pdf * pdf;
+		return square / (square + otherPdf * otherPdf);
+	}
+
+	// FNV-1a, used to recognize the scene and camera a checkpoint was rendered with
+	static void Hash(uint64_t& hash, const void* data, size_t size)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+		}
+	}
+
+	static uint64_t HashScene(const Scene& scene)
+	{
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (const Sphere& sphere : scene.Spheres)
+		{
+			Hash(hash, &sphere.Position, sizeof(sphere.Position));
+			Hash(hash, &sphere.radius, sizeof(sphere.radius));
+			Hash(hash, &sphere.MaterialIndex, sizeof(sphere.MaterialIndex));
+		}
+		for (const Cube& cube : scene.Cubes)
+		{
+			Hash(hash, &cube.min, sizeof(cube.min));
+			Hash(hash, &cube.max, sizeof(cube.max));
+			Hash(hash, &cube.MaterialIndex, sizeof(cube.MaterialIndex));
+		}
+		for (const Material& material : scene.Materials)
+		{
+			// field by field, the padding bytes of the struct are undefined
+			Hash(hash, &material.Albedo, sizeof(material.Albedo));
+			Hash(hash, &material.roughness, sizeof(float) * 4);
+			Hash(hash, &material.emissionPow, sizeof(material.emissionPow));
+			Hash(hash, &material.emissionCol, sizeof(material.emissionCol));
+		}
+		if (scene.Environment)
+		{
+			Hash(hash, scene.Environment->GetPath().data(), scene.Environment->GetPath().size());
+			Hash(hash, &scene.Environment->Intensity, sizeof(float));
+		}
+		return hash;
+	}
+
+	static uint64_t HashCamera(const Camera& camera)
+	{
+		uint64_t hash = 0xCBF29CE484222325ull;
+		Hash(hash, &camera.GetView(), sizeof(glm::mat4));
+		Hash(hash, &camera.GetProjection(), sizeof(glm::mat4));
+		return hash;
+	}
+}
+
+Renderer::~Renderer()
+{
+	if (!m_Checkpoint.IsOpen())
+		delete[] m_AccumulationData;
+	delete[] m_ImageData;
 }
 
 void Renderer::Render(const Scene& scene, const Camera& camera)
 {
+	UpdateThreadPool();
+
 	m_ActiveScene = &scene;
 	m_ActiveCamera = &camera;
+	m_Environment = (m_Settings.ambientOcclusion && scene.Environment) ? scene.Environment.get() : nullptr;
 
-	if (m_FrameCount == 1)
+	CompileMaterials();
+	UpdatePrimitiveTable();
+	UpdateTileBins();
+
+	if (m_Checkpoint.IsOpen())
+	{
+		ValidateCheckpoint();
+	}
+	m_FrameSeed = Utils::PCG_Hash(m_FrameCount ^ Utils::PCG_Hash(m_RunSeed));
+
+	m_LastBuildTime = 0.0f;
+	m_LastBuildKind = BuildKind::None;
+	if (m_Settings.acceleration != Acceleration::BruteForce)
+	{
+		UpdateAccelerationStructure();
+	}
+
+	Walnut::Timer traceTimer;
+
+	bool tileFrames = UseTileFrames();
+	if (!tileFrames)
+	{
+		LeaveTileFrames();
+		if (m_ResetFocusTiles)
+		{
+			m_FrameCount = 1;
+			m_ResetFocusTiles = false;
+		}
+	}
+
+	if (m_FrameCount == 1 && !m_ThreadPool && !tileFrames)
 	{
 		// clear the buffer to all 0
 		// memset does this by setting integer values of 0 instead of float zeroes
 		// float and int zeroes are represented the same way in memory
-		memset(m_AccumulationData, 0, m_FinalImage->GetHeight() * m_FinalImage->GetWidth() * sizeof(glm::vec4));
+		memset(m_AccumulationData, 0, m_Height * m_Width * sizeof(glm::vec4));
 	}
 
-	if (m_Settings.Multithreading)
+	if (tileFrames)
+	{
+		// region of interest, focus material or priority scheduling: the tiles clear their own samples
+		RenderTileFrames();
+	}
+	else if (m_ThreadPool)
+	{
+		// every row is rendered by the NUMA node its memory is on. clearing the rows here
+		// instead of with one memset keeps the other nodes from writing to those pages
+		m_ThreadPool->ForEachRow(m_Height, [this](uint32_t y) {
+			if (m_FrameCount == 1)
+			{
+				memset(&m_AccumulationData[y * m_Width], 0, m_Width * sizeof(glm::vec4));
+			}
+			RenderRow(y);
+		});
+	}
+	else if (m_Settings.Multithreading && m_UseTileBins)
+	{
+		// tile by tile, the threads keep the list of primitives of their tile in the cache
+		std::for_each(std::execution::par, m_TileIterator.begin(), m_TileIterator.end(),
+			[this](uint32_t tile) {
+				RenderTile(tile);
+			});
+	}
+	else if (m_Settings.Multithreading)
 	{
 		std::for_each(std::execution::par, m_verticalImgIterator.begin(), m_verticalImgIterator.end(),
 			[this](uint32_t y) {
-				for (uint32_t x = 0; x < m_FinalImage->GetWidth(); x++)
-				{
-					//PerPixel(x, y);
-
-					//glm::vec2 coordinate = { (float)x / (float)m_FinalImage->GetWidth(), (float)y / (float)m_FinalImage->GetHeight() };
-					//coordinate = coordinate * 2.0f - 1.0f; //coordinate range is now from -1 to 1
-					//const glm::vec3& rayDir = camera.GetRayDirections()[x + y * m_FinalImage->GetWidth() ];
+				RenderRow(y);
+			});
+	}
+	else
+	{
+		// this renders every pixel we have
+		for (uint32_t y = 0; y < m_Height; y++)
+		{
+			RenderRow(y);
+		}
+	}
 
-					glm::vec4 color = PerPixel(x, y);
-					m_AccumulationData[x + y * m_FinalImage->GetWidth()] += color; // collect samples by adding them up
+	m_LastTraceTime = traceTimer.ElapsedMillis();
+	UpdateMemoryUsage();
 
-					glm::vec4 avgColor = m_AccumulationData[x + y * m_FinalImage->GetWidth()];
-					avgColor /= (float)m_FrameCount;
+	if (m_FinalImage)
+	{
+		m_FinalImage->SetData(m_ImageData);
+	}
 
-					avgColor = glm::clamp(avgColor, glm::vec4(0.0f), glm::vec4(1.0f)); // ensure that each rgba channel is between 0 and 1
-					m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(avgColor); // calculate the correct adress each pixel is stored in
-					//m_ImageData[i] = 0xff00ffff; // ff=alpha, 00=blue, ff=green, ff=red
-					//m_ImageData[x] = Walnut::Random::UInt();
-					//m_ImageData[x] |= 0xff000000; // ensure the alpha channel is alwas at 255
-				}
-			});
+	if (m_Settings.Accumulate)
+	{
+		m_FrameCount++;
 	}
 	else
 	{
-		// this renders every pixel we have
-		for (uint32_t y = 0; y < m_FinalImage->GetHeight(); y++)
+		m_FrameCount = 1;
+	}
+
+	if (m_Checkpoint.IsOpen())
+	{
+		m_Checkpoint.GetHeader().frameCount = m_FrameCount;
+	}
+}
+
+void Renderer::RenderRegion(const Scene& scene, const Camera& camera, uint32_t regionX, uint32_t regionY, uint32_t regionWidth, uint32_t regionHeight,
+	uint32_t firstFrame, uint32_t frameCount, glm::vec4* sums)
+{
+	m_ActiveScene = &scene;
+	m_ActiveCamera = &camera;
+	m_Environment = (m_Settings.ambientOcclusion && scene.Environment) ? scene.Environment.get() : nullptr;
+
+	CompileMaterials();
+	UpdatePrimitiveTable();
+	UpdateTileBins();
+
+	m_LastBuildTime = 0.0f;
+	m_LastBuildKind = BuildKind::None;
+	if (m_Settings.acceleration != Acceleration::BruteForce)
+	{
+		UpdateAccelerationStructure();
+	}
+
+	Walnut::Timer traceTimer;
+
+	std::vector<uint32_t> rows(regionHeight);
+	std::iota(rows.begin(), rows.end(), 0);
+
+	auto renderRow = [&](uint32_t row) {
+		uint32_t y = regionY + row;
+		for (uint32_t column = 0; column < regionWidth; column++)
 		{
-			for (uint32_t x = 0; x < m_FinalImage->GetWidth(); x++)
-			{
-				//PerPixel(x, y);
+			sums[column + row * regionWidth] += PerPixel(regionX + column, y, m_FrameSeed);
+		}
+	};
 
-				//glm::vec2 coordinate = { (float)x / (float)m_FinalImage->GetWidth(), (float)y / (float)m_FinalImage->GetHeight() };
-				//coordinate = coordinate * 2.0f - 1.0f; //coordinate range is now from -1 to 1
-				//const glm::vec3& rayDir = camera.GetRayDirections()[x + y * m_FinalImage->GetWidth() ];
+	// frame by frame, PerPixel takes the seed of the frame from m_FrameSeed
+	for (uint32_t frame = firstFrame; frame < firstFrame + frameCount; frame++)
+	{
+		m_FrameSeed = Utils::PCG_Hash(frame ^ Utils::PCG_Hash(m_RunSeed));
 
-				glm::vec4 color = PerPixel(x, y);
-				m_AccumulationData[x + y * m_FinalImage->GetWidth()] += color; // collect samples by adding them up
+		if (m_Settings.Multithreading)
+			std::for_each(std::execution::par, rows.begin(), rows.end(), renderRow);
+		else
+			std::for_each(rows.begin(), rows.end(), renderRow);
+	}
 
-				glm::vec4 avgColor = m_AccumulationData[x + y * m_FinalImage->GetWidth()];
-				avgColor /= (float)m_FrameCount;
+	m_LastTraceTime = traceTimer.ElapsedMillis();
+	UpdateMemoryUsage();
+}
 
-				avgColor = glm::clamp(avgColor, glm::vec4(0.0f), glm::vec4(1.0f)); // ensure that each rgba channel is between 0 and 1
-				m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(avgColor); // calculate the correct adress each pixel is stored in
-				//m_ImageData[i] = 0xff00ffff; // ff=alpha, 00=blue, ff=green, ff=red
-				//m_ImageData[x] = Walnut::Random::UInt();
-				//m_ImageData[x] |= 0xff000000; // ensure the alpha channel is alwas at 255
-			}
+void Renderer::RenderRow(uint32_t y)
+{
+	for (uint32_t x = 0; x < m_Width; x++)
+	{
+		RenderPixel(x, y, m_FrameSeed, m_FrameCount);
+	}
+}
+
+void Renderer::RenderTile(uint32_t tile)
+{
+	uint32_t minX, minY, maxX, maxY;
+	GetTileBounds(tile, minX, minY, maxX, maxY);
+
+	for (uint32_t y = minY; y < maxY; y++)
+	{
+		for (uint32_t x = minX; x < maxX; x++)
+		{
+			RenderPixel(x, y, m_FrameSeed, m_FrameCount);
 		}
 	}
+}
+
+void Renderer::GetTileBounds(uint32_t tile, uint32_t& minX, uint32_t& minY, uint32_t& maxX, uint32_t& maxY) const
+{
+	minX = (tile % m_TilesX) * TileBins::TileSize;
+	minY = (tile / m_TilesX) * TileBins::TileSize;
+	maxX = glm::min(minX + TileBins::TileSize, m_Width);
+	maxY = glm::min(minY + TileBins::TileSize, m_Height);
+}
 
-	m_FinalImage->SetData(m_ImageData);
+bool Renderer::UseTileFrames() const
+{
+	// the header of a checkpoint only has one frame count for all pixels
+	if (m_Checkpoint.IsOpen())
+		return false;
+	return m_Settings.PriorityTiles || HasRegionOfInterest() || (m_FocusMaterial >= 0 && m_UseTileBins);
+}
 
-	if (m_Settings.Accumulate)
+void Renderer::RenderTileFrames()
+{
+	uint32_t tileCount = m_TilesX * m_TilesY;
+	if (!m_TileFramesValid || !m_Settings.Accumulate)
 	{
-		m_FrameCount++;
+		// coming from one frame count for the whole image, all tiles continue from it
+		m_TileFrames.assign(tileCount, m_FrameCount - 1);
+		m_TileFramesValid = true;
+	}
+
+	if (m_ResetFocusTiles)
+	{
+		// all tiles of the material, also the ones outside of the region of interest, or they would
+		// mix the old material into their samples once the region gets to them
+		for (uint32_t tile = 0; tile < tileCount; tile++)
+		{
+			if (TileShowsMaterial(tile, m_FocusMaterial))
+				m_TileFrames[tile] = 0;
+		}
+		m_ResetFocusTiles = false;
+	}
+
+	CollectActiveTiles();
+	if (m_ActiveTiles.empty())
+	{
+		m_FrameCount = 0;
+		return;
+	}
+
+	if (!m_Settings.PriorityTiles)
+	{
+		// every tile of the region once, at the full rate of a normal frame
+		if (m_Settings.Multithreading)
+			std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.end(), [this](uint32_t tile) { RenderTileFrame(tile); });
+		else
+			std::for_each(m_ActiveTiles.begin(), m_ActiveTiles.end(), [this](uint32_t tile) { RenderTileFrame(tile); });
 	}
 	else
 	{
-		m_FrameCount = 1;
+		UpdateTileSpiral();
+
+		// a tile waits longer the more samples it has and the further out on the spiral it is,
+		// so the tiles around the focus converge first but the outer ones are never starved
+		auto priority = [this](uint32_t tile) {
+			return (float)(m_TileFrames[tile] + 1) * (1.0f + m_Settings.PriorityFalloff * m_TileSpiral[tile]);
+		};
+		auto before = [&](uint32_t a, uint32_t b) { return priority(a) < priority(b); };
+
+		// small batches of the most urgent tiles until the budget of the frame is used up
+		size_t batchSize = m_Settings.Multithreading ? std::max<size_t>(std::thread::hardware_concurrency() * 2, 1) : 1;
+		batchSize = std::min(batchSize, m_ActiveTiles.size());
+
+		Walnut::Timer budget;
+		do
+		{
+			std::partial_sort(m_ActiveTiles.begin(), m_ActiveTiles.begin() + batchSize, m_ActiveTiles.end(), before);
+			if (m_Settings.Multithreading)
+				std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.begin() + batchSize, [this](uint32_t tile) { RenderTileFrame(tile); });
+			else
+				RenderTileFrame(m_ActiveTiles[0]);
+		} while (budget.ElapsedMillis() < m_Settings.PriorityBudgetMs && m_Settings.Accumulate);
+	}
+
+	// the least converged tile of the region is what GetAccumulatedFrames reports, Render adds the one for the next frame
+	uint32_t minFrames = std::numeric_limits<uint32_t>::max();
+	for (uint32_t tile : m_ActiveTiles)
+	{
+		minFrames = std::min(minFrames, m_TileFrames[tile]);
+	}
+	m_FrameCount = minFrames;
+}
+
+void Renderer::RenderTileFrame(uint32_t tile)
+{
+	uint32_t minX, minY, maxX, maxY;
+	GetTileBounds(tile, minX, minY, maxX, maxY);
+
+	// the same random numbers as the frame with this number in a normal render
+	uint32_t frameCount = ++m_TileFrames[tile];
+	uint32_t frameSeed = Utils::PCG_Hash(frameCount ^ Utils::PCG_Hash(m_RunSeed));
+
+	for (uint32_t y = minY; y < maxY; y++)
+	{
+		if (frameCount == 1)
+		{
+			memset(&m_AccumulationData[minX + y * m_Width], 0, (maxX - minX) * sizeof(glm::vec4));
+		}
+		for (uint32_t x = minX; x < maxX; x++)
+		{
+			RenderPixel(x, y, frameSeed, frameCount);
+		}
+	}
+}
+
+void Renderer::LeaveTileFrames()
+{
+	if (!m_TileFramesValid)
+		return;
+	m_TileFramesValid = false;
+
+	// after a reset the render starts over anyway
+	if (m_FrameCount == 1)
+		return;
+
+	bool same = std::all_of(m_TileFrames.begin(), m_TileFrames.end(), [&](uint32_t frames) { return frames == m_TileFrames[0]; });
+	m_FrameCount = (same && !m_TileFrames.empty()) ? m_TileFrames[0] + 1 : 1;
+}
+
+void Renderer::CollectActiveTiles()
+{
+	m_ActiveTiles.clear();
+
+	glm::uvec4 roi = m_RegionOfInterest;
+	bool material = m_FocusMaterial >= 0 && m_UseTileBins;
+	for (uint32_t tile = 0; tile < m_TilesX * m_TilesY; tile++)
+	{
+		uint32_t minX, minY, maxX, maxY;
+		GetTileBounds(tile, minX, minY, maxX, maxY);
+
+		// whole tiles: a tile only partly inside the region still gets all its pixels, they share one frame count
+		if (HasRegionOfInterest() && (maxX <= roi.x || minX >= roi.x + roi.z || maxY <= roi.y || minY >= roi.y + roi.w))
+			continue;
+
+		if (material && !TileShowsMaterial(tile, m_FocusMaterial))
+			continue;
+
+		m_ActiveTiles.push_back(tile);
 	}
 }
 
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
+bool Renderer::TileShowsMaterial(uint32_t tile, int materialIndex) const
+{
+	uint32_t minX, minY, maxX, maxY;
+	GetTileBounds(tile, minX, minY, maxX, maxY);
+
+	TileBins::Bin bin = m_TileBins.GetBin(minX, minY);
+	for (uint32_t i = 0; i < bin.count; i++)
+	{
+		uint32_t index = PrimitiveId::Index(bin.ids[i]);
+		int primitiveMaterial = (PrimitiveId::Type(bin.ids[i]) == PrimitiveType::Sphere)
+			? m_ActiveScene->Spheres[index].MaterialIndex
+			: m_ActiveScene->Cubes[index].MaterialIndex;
+		if (primitiveMaterial == materialIndex)
+			return true;
+	}
+	return false;
+}
+
+void Renderer::UpdateTileSpiral()
+{
+	if (!m_TileSpiralDirty && m_TileSpiral.size() == m_TilesX * m_TilesY)
+		return;
+
+	m_TileSpiral.resize(m_TilesX * m_TilesY);
+	m_TileSpiralDirty = false;
+
+	// without a focus on the image the spiral starts in the middle
+	glm::uvec2 focus = m_Focus;
+	if (focus.x >= m_Width || focus.y >= m_Height)
+		focus = { m_Width / 2, m_Height / 2 };
+	int focusX = (int)(focus.x >> TileBins::TileShift);
+	int focusY = (int)(focus.y >> TileBins::TileShift);
+
+	for (uint32_t tile = 0; tile < m_TilesX * m_TilesY; tile++)
+	{
+		int dx = (int)(tile % m_TilesX) - focusX;
+		int dy = (int)(tile / m_TilesX) - focusY;
+		int ring = std::max(std::abs(dx), std::abs(dy));
+		float angle = (std::atan2((float)dy, (float)dx) + glm::pi<float>()) / (2.0f * glm::pi<float>());
+		m_TileSpiral[tile] = (float)ring + 0.99f * angle;
+	}
+}
+
+void Renderer::RenderPixel(uint32_t x, uint32_t y, uint32_t frameSeed, uint32_t frameCount)
+{
+	//glm::vec2 coordinate = { (float)x / (float)m_FinalImage->GetWidth(), (float)y / (float)m_FinalImage->GetHeight() };
+	//coordinate = coordinate * 2.0f - 1.0f; //coordinate range is now from -1 to 1
+	//const glm::vec3& rayDir = camera.GetRayDirections()[x + y * m_FinalImage->GetWidth() ];
+
+	glm::vec4 color = PerPixel(x, y, frameSeed);
+	m_AccumulationData[x + y * m_Width] += color; // collect samples by adding them up
+
+	glm::vec4 avgColor = m_AccumulationData[x + y * m_Width];
+	avgColor /= (float)frameCount;
+
+	avgColor = glm::clamp(avgColor, glm::vec4(0.0f), glm::vec4(1.0f)); // ensure that each rgba channel is between 0 and 1
+	m_ImageData[x + y * m_Width] = Utils::ConvertToRGBA(avgColor); // calculate the correct adress each pixel is stored in
+	//m_ImageData[i] = 0xff00ffff; // ff=alpha, 00=blue, ff=green, ff=red
+	//m_ImageData[x] = Walnut::Random::UInt();
+	//m_ImageData[x] |= 0xff000000; // ensure the alpha channel is alwas at 255
+}
+
+glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, uint32_t frameSeed)
 {
 	Ray ray;
 	ray.Origin = m_ActiveCamera->GetPosition();
-	ray.Direction = m_ActiveCamera->GetRayDirections()[x + y * m_FinalImage->GetWidth()];
 
+	uint32_t seed = Utils::PCG_Hash((x + y * m_Width) ^ frameSeed);
+
+	uint32_t samples = m_Settings.SamplesPerFrame;
+	if (samples <= 1)
+	{
+		// one ray exactly through the pixel, like every frame before there were more samples per frame
+		ray.Direction = m_ActiveCamera->GetRayDirection(x, y);
+		return glm::vec4(TracePath(ray, x, y, seed), 1.0f);
+	}
+
+	// the samples are spread over a grid of strata and jittered inside their stratum, then moved
+	// by the tent filter (radius 1 pixel). the filter is importance sampled, so every sample has
+	// the same weight and the pixel is their average.
+	// the grid only has as many strata as it can fill completely, a partly filled row would leave
+	// part of the pixel without samples. the samples left over are spread over the whole pixel
+	uint32_t columns = (uint32_t)glm::sqrt((float)samples);
+	uint32_t rows = samples / columns;
+	uint32_t strata = columns * rows;
+
+	glm::vec3 light(0.0f);
+	for (uint32_t sample = 0; sample < samples; sample++)
+	{
+		glm::vec2 u;
+		u.x = Utils::RandomFloat(seed);
+		u.y = Utils::RandomFloat(seed);
+		if (sample < strata)
+			u = (glm::vec2((float)(sample % columns), (float)(sample / columns)) + u) / glm::vec2((float)columns, (float)rows);
+		glm::vec2 offset(Utils::SampleTent(u.x), Utils::SampleTent(u.y));
+
+		ray.Origin = m_ActiveCamera->GetPosition();
+		ray.Direction = m_ActiveCamera->GetRayDirection(glm::vec2((float)x, (float)y) + offset);
+		light += TracePath(ray, x, y, seed);
+	}
+	return glm::vec4(light / (float)samples, 1.0f);
+}
+
+glm::vec3 Renderer::TracePath(Ray& ray, uint32_t x, uint32_t y, uint32_t& seed)
+{
 	glm::vec3 light(0.0f, 0.0f, 0.0f);
 	glm::vec3 throughput( 1.0f );
 
+	// pdf of the last bounce direction if it came from a diffuse hit which also sampled the environment
+	float diffusePdf = 0.0f;
+
 	int bounceCount = 5;
 	for (int i = 0; i < bounceCount; i++)
 	{
-		Renderer::HitPayload payload = TraceRay(ray);
+		Hit hit = (i == 0 && m_UseTileBins) ? TracePrimaryRay(ray, x, y) : TraceRay(ray);
 
-		if (payload.hitDist < 0.0f)
+		if (hit.t < 0.0f)
 		{
 			glm::vec3 skyColor = (m_Settings.ambientOcclusion)? glm::vec3(0.6f, 0.7f, 0.9f) : glm::vec3( 0.0f );
 			//light += skyColor * throughput;
 
+			if (m_Environment)
+			{
+				skyColor = m_Environment->Evaluate(ray.Direction);
+
+				// the direction could also have been picked by SampleEnvironment, both share the light
+				if (diffusePdf > 0.0f)
+				{
+					skyColor *= Utils::PowerHeuristic(diffusePdf, m_Environment->Pdf(ray.Direction));
+				}
+			}
+
 			if (1)
 			{
 				light += skyColor * throughput;
@@ -128,162 +589,427 @@ glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
 		//glm::vec3 lightDir = glm::normalize(glm::vec3(-1, -1, -1));
 		//float lightInt = glm::max(glm::dot(payload.WorldNorm, -lightDir), 0.0f); // dot product = cos(angle) but only positive values
 
-		const Sphere& sphere = m_ActiveScene->Spheres[payload.objectIndex];
-		const Material& material = m_ActiveScene->Materials[sphere.MaterialIndex];
+		Renderer::HitPayload payload = ReconstructHit(ray, hit);
+		const Material& material = m_ActiveScene->Materials[payload.materialIndex];
 
-		light += material.GetEmission() * throughput;
+		if (m_Settings.SpecialisedShading)
+		{
+			ShadeSpecialised(m_MaterialTypes[payload.materialIndex], ray, payload, material, light, throughput, seed);
+		}
+		else
+		{
+			ShadeGeneric(ray, payload, material, light, throughput, seed);
+		}
 
-		//the throughput is eventially decrease or stay at one but will
-		//never ever increase. in physics: conservation of energy law!
-		throughput *= material.Albedo;
+		// only the specialised diffuse shading samples the environment directly
+		diffusePdf = 0.0f;
+		if (m_Environment && m_Settings.SpecialisedShading && m_MaterialTypes[payload.materialIndex] == MaterialType::Diffuse)
+		{
+			diffusePdf = glm::max(glm::dot(payload.WorldNorm, ray.Direction), 0.0f) / glm::pi<float>();
+		}
+	}
+	return light;
+}
 
-		//handle the tramsparency
-		if (material.transparency > 0.0f)
+void Renderer::UpdateAccelerationStructure()
+{
+	Walnut::Timer timer;
+	m_LastBuildKind = BuildKind::None;
+
+	const size_t primitiveCount = m_ActiveScene->Spheres.size() + m_ActiveScene->Cubes.size();
+	if (m_BVHScene != m_ActiveScene || m_BVHPrimitiveCount != primitiveCount || m_BVH.GetBuildMethod() != m_Settings.buildMethod)
+	{
+		// another scene, primitives were added/removed or another build method was chosen, the old tree is of no use.
+		// the build also sets the cost the refits are compared to for the new method
+		m_BVH.Build(*m_ActiveScene, m_Settings.buildMethod);
+		m_LastBuildKind = BuildKind::Rebuild;
+	}
+	else if (m_Settings.acceleration == Acceleration::WideBVH && !m_BVH.HasWideNodes() && !m_MemoryUsage.wideBVHDropped && primitiveCount > 0)
+	{
+		// the wide nodes were dropped for the memory budget and fit in again
+		m_BVH.Build(*m_ActiveScene, m_Settings.buildMethod);
+		m_LastBuildKind = BuildKind::Rebuild;
+	}
+	else if (m_BVHDirty)
+	{
+		// primitives only moved: refitting keeps the tree and is much cheaper than a build,
+		// but the boxes grow and overlap more the further things move from where they were built.
+		// once the tree is too much worse than a fresh one the rebuild pays for itself
+		m_BVH.Refit(*m_ActiveScene);
+		m_LastBuildKind = BuildKind::Refit;
+
+		if (m_BVH.GetCost() > m_BVH.GetBuildCost() * m_Settings.RebuildThreshold)
 		{
-			glm::vec3 refractedDirection = glm::refract(ray.Direction, payload.WorldNorm, 1.0f / material.refractiveIndex);
+			m_BVH.Build(*m_ActiveScene, m_Settings.buildMethod);
+			m_LastBuildKind = BuildKind::Rebuild;
+		}
+	}
 
-			// Check for total internal reflection
-			if (glm::length(refractedDirection) == 0.0f) // This means total internal reflection occurred
-			{
-				ray.Direction = glm::reflect(ray.Direction, payload.WorldNorm);
-			}
-			else
-			{
-				ray.Origin = payload.WorldPos + refractedDirection;
-				ray.Direction = refractedDirection;
-				throughput *= glm::vec3(material.transparency);
-			}
+	m_BVHScene = m_ActiveScene;
+	m_BVHPrimitiveCount = primitiveCount;
+	m_BVHDirty = false;
+
+	m_LastBuildTime = timer.ElapsedMillis();
+}
+
+std::vector<Renderer::AccelerationBenchmark> Renderer::BenchmarkAcceleration(const Scene& scene, const Camera& camera, uint32_t frames) const
+{
+	// a renderer of its own, this one keeps its samples, its checkpoint file and its acceleration structure
+	Renderer renderer(true);
+	renderer.m_Settings = m_Settings;
+	renderer.SetRunSeed(m_RunSeed);
+	renderer.onResize(m_Width, m_Height);
+
+	const Acceleration candidates[] = { Acceleration::BruteForce, Acceleration::BinaryBVH, Acceleration::WideBVH };
+
+	std::vector<AccelerationBenchmark> results;
+	for (Acceleration acceleration : candidates)
+	{
+		renderer.m_Settings.acceleration = acceleration;
+		renderer.m_BVHScene = nullptr; // force a full build, it is timed separately from the frames
+
+		Walnut::Timer timer;
+		if (acceleration != Acceleration::BruteForce)
+		{
+			renderer.m_ActiveScene = &scene;
+			renderer.UpdateAccelerationStructure();
 		}
-		else
+		float buildMs = timer.ElapsedMillis();
+
+		renderer.FrameCountReset();
+		timer.Reset();
+		for (uint32_t i = 0; i < frames; i++)
 		{
-			// set the ray origin to the hit position (which is worldposition)
-			// it is also required to move a minuscule amount aoutwards due to 
-			// some uncertainty within floating point numbers
-			// there could be a colision with the sphere itseolf directly at the start/origin
-			// so adding a tiny amount in the Normal's direction fixes this
-			ray.Origin = payload.WorldPos + payload.WorldNorm * 0.0001f;
+			renderer.Render(scene, camera);
+		}
 
-			// calc the reflected ray direction.
-			// the incoming angle from the ray to the Normal is equal to the outgoing angle
-			// this is a simple optical law in physics
-			// however tis is VERY idealized assuming a perfectly flat surface (which physically cannot exist):
-			//ray.Direction = glm::reflect(ray.Direction, payload.WorldNorm);
+		AccelerationBenchmark& result = results.emplace_back();
+		result.acceleration = acceleration;
+		result.buildMs = buildMs;
+		result.frameMs = timer.ElapsedMillis() / (float)frames;
+	}
 
-			//this is a more realistic approach:
-			//ray.Direction = glm::reflect(ray.Direction, 
-				//payload.WorldNorm + material.roughness * Walnut::Random::Vec3(-0.5f, 0.5));
+	return results;
+}
 
-			//ray.Direction = glm::normalize(payload.WorldNorm + Walnut::Random::InUnitSphere());
-			ray.Direction = ReflectRay(ray.Direction, payload.WorldNorm, material.roughness, material.metallic);
-		}
+void Renderer::CompileMaterials()
+{
+	m_MaterialTypes.resize(m_ActiveScene->Materials.size());
+	for (size_t i = 0; i < m_ActiveScene->Materials.size(); i++)
+	{
+		m_MaterialTypes[i] = m_ActiveScene->Materials[i].Classify();
 	}
-	return glm::vec4(light, 1.0f);
 }
 
-Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
+void Renderer::ShadeSpecialised(MaterialType type, Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& light, glm::vec3& throughput, uint32_t& seed)
 {
-	// the following equation defines the points of an intersection between a ray and a circle
-	// (bx^2 + by^2)t^2 + (2axbx + 2ayby)t + (ax^2 + ay^2 - r^2) = 0
-	// simplify by factoring 2 out
-	// (bx^2 + by^2)t^2 + (2(axbx + ayby))t + (ax^2 + ay^2 - r^2) = 0
-	// a is the origin / pixel; b is the direction; r is sphere radius; t is intersection distance
-	
-	int closestSphere = -1;
-	float hitDist = std::numeric_limits<float>::max(); // set hit distance to infinity
+	// a switch over the few variants is a single jump, after that every
+	// shading function is compiled for exactly one kind of material
+	switch (type)
+	{
+	case MaterialType::Diffuse:		Shade<MaterialType::Diffuse>(ray, payload, material, light, throughput, seed); break;
+	case MaterialType::Mirror:		Shade<MaterialType::Mirror>(ray, payload, material, light, throughput, seed); break;
+	case MaterialType::Glossy:		Shade<MaterialType::Glossy>(ray, payload, material, light, throughput, seed); break;
+	case MaterialType::Dielectric:	Shade<MaterialType::Dielectric>(ray, payload, material, light, throughput, seed); break;
+	case MaterialType::Emissive:	Shade<MaterialType::Emissive>(ray, payload, material, light, throughput, seed); break;
+	}
+}
 
-	for (size_t i = 0; i < m_ActiveScene->Spheres.size(); ++i)
+template<MaterialType Type>
+void Renderer::Shade(Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& light, glm::vec3& throughput, uint32_t& seed)
+{
+	// only emissive materials can add light, all the others have an emission of 0
+	if constexpr (Type == MaterialType::Emissive)
 	{
-		const Sphere& sphere = m_ActiveScene->Spheres[i];
+		light += material.GetEmission() * throughput;
+	}
 
-		glm::vec3 origin = ray.Origin - sphere.Position;
+	throughput *= material.Albedo;
 
-		float a = glm::dot(ray.Direction, ray.Direction);
-		float b = 2.0f * glm::dot(origin, ray.Direction);
-		float c = glm::dot(origin, origin) - sphere.radius * sphere.radius;
+	if constexpr (Type == MaterialType::Dielectric)
+	{
+		RefractRay(ray, payload, material, throughput);
+		return;
+	}
+	else if constexpr (Type == MaterialType::Emissive)
+	{
+		// emissive is the catch all variant, so it still has to check for transparency
+		if (material.transparency > 0.0f)
+		{
+			RefractRay(ray, payload, material, throughput);
+			return;
+		}
+	}
 
-		// calculate the discriminant of the PQ-formula: b^2 - 4ac
-		float discr = b * b - 4.0f * a * c;
+	ray.Origin = payload.WorldPos + payload.WorldNorm * 0.0001f;
 
-		if (discr < 0.0f) // ray didnt hit anything
+	if constexpr (Type == MaterialType::Diffuse)
+	{
+		if (m_Environment)
 		{
-			continue;
+			SampleEnvironment(payload, light, throughput, seed);
 		}
 
-		// now use the PQ-formula to get points of intersection (-b (+-) sqrt(discr)) / 2a
-		//float tPlus = (-b + glm::sqrt(discr)) / (2.0f * a); // (unused) as a > 0 this is always bigger than calc above
-		float tClosest = (-b - glm::sqrt(discr)) / (2.0f * a);
-		if (tClosest > 0.0f && tClosest < hitDist)
+		// metallic is 0 so the mix would only return the lambertian ray
+		ray.Direction = glm::normalize(payload.WorldNorm + Utils::InUnitSphere(seed));
+	}
+	else if constexpr (Type == MaterialType::Mirror)
+	{
+		// metallic is 1 so the mix would only return the reflected ray, no random direction needed
+		ray.Direction = glm::reflect(ray.Direction, payload.WorldNorm);
+	}
+	else
+	{
+		ray.Direction = ReflectRay(ray.Direction, payload.WorldNorm, material.roughness, material.metallic, seed);
+	}
+}
+
+void Renderer::SampleEnvironment(const HitPayload& payload, glm::vec3& light, const glm::vec3& throughput, uint32_t& seed)
+{
+	glm::vec3 direction;
+	float lightPdf;
+	float u0 = Utils::RandomFloat(seed);
+	float u1 = Utils::RandomFloat(seed);
+	float u2 = Utils::RandomFloat(seed);
+	float u3 = Utils::RandomFloat(seed);
+	glm::vec3 radiance = m_Environment->Sample(u0, u1, u2, u3, direction, lightPdf);
+
+	float cosine = glm::dot(payload.WorldNorm, direction);
+	if (cosine <= 0.0f || lightPdf <= 0.0f)
+		return;
+
+	// the light only arrives if nothing is in the way
+	Ray shadowRay;
+	shadowRay.Origin = payload.WorldPos + payload.WorldNorm * 0.0001f;
+	shadowRay.Direction = direction;
+	if (TraceRay(shadowRay).t >= 0.0f)
+		return;
+
+	// the diffuse bounce picks directions close to cos / pi, the albedo is in the throughput already
+	float diffusePdf = cosine / glm::pi<float>();
+	light += throughput * radiance * (diffusePdf / lightPdf) * Utils::PowerHeuristic(lightPdf, diffusePdf);
+}
+
+// this is the original shading which handles every material in the same way.
+// it is kept for comparison with the specialised variants
+void Renderer::ShadeGeneric(Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& light, glm::vec3& throughput, uint32_t& seed)
+{
+	light += material.GetEmission() * throughput;
+
+	//the throughput is eventially decrease or stay at one but will
+	//never ever increase. in physics: conservation of energy law!
+	throughput *= material.Albedo;
+
+	//handle the tramsparency
+	if (material.transparency > 0.0f)
+	{
+		glm::vec3 refractedDirection = glm::refract(ray.Direction, payload.WorldNorm, 1.0f / material.refractiveIndex);
+
+		// Check for total internal reflection
+		if (glm::length(refractedDirection) == 0.0f) // This means total internal reflection occurred
 		{
-			hitDist = tClosest;
-			closestSphere = (int)i;
+			ray.Direction = glm::reflect(ray.Direction, payload.WorldNorm);
 		}
+		else
+		{
+			ray.Origin = payload.WorldPos + refractedDirection;
+			ray.Direction = refractedDirection;
+			throughput *= glm::vec3(material.transparency);
+		}
+	}
+	else
+	{
+		// set the ray origin to the hit position (which is worldposition)
+		// it is also required to move a minuscule amount aoutwards due to 
+		// some uncertainty within floating point numbers
+		// there could be a colision with the sphere itseolf directly at the start/origin
+		// so adding a tiny amount in the Normal's direction fixes this
+		ray.Origin = payload.WorldPos + payload.WorldNorm * 0.0001f;
+
+		// calc the reflected ray direction.
+		// the incoming angle from the ray to the Normal is equal to the outgoing angle
+		// this is a simple optical law in physics
+		// however tis is VERY idealized assuming a perfectly flat surface (which physically cannot exist):
+		//ray.Direction = glm::reflect(ray.Direction, payload.WorldNorm);
+
+		//this is a more realistic approach:
+		//ray.Direction = glm::reflect(ray.Direction, 
+			//payload.WorldNorm + material.roughness * Walnut::Random::Vec3(-0.5f, 0.5));
+
+		//ray.Direction = glm::normalize(payload.WorldNorm + Utils::InUnitSphere(seed));
+		ray.Direction = ReflectRay(ray.Direction, payload.WorldNorm, material.roughness, material.metallic, seed);
+	}
+}
 
+void Renderer::RefractRay(Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& throughput)
+{
+	glm::vec3 refractedDirection = glm::refract(ray.Direction, payload.WorldNorm, 1.0f / material.refractiveIndex);
+
+	// Check for total internal reflection
+	if (glm::length(refractedDirection) == 0.0f) // This means total internal reflection occurred
+	{
+		ray.Direction = glm::reflect(ray.Direction, payload.WorldNorm);
 	}
+	else
+	{
+		ray.Origin = payload.WorldPos + refractedDirection;
+		ray.Direction = refractedDirection;
+		throughput *= glm::vec3(material.transparency);
+	}
+}
 
-	int closestCube = -1;
-	bool isCubeHit = false;
-	for (size_t i = 0; i < m_ActiveScene->Cubes.size(); ++i) // cube intersection
+std::vector<Renderer::ShadingBenchmark> Renderer::BenchmarkShading(const Scene& scene, uint32_t iterations)
+{
+	m_ActiveScene = &scene;
+	m_Environment = nullptr; // only the shading itself is measured, not the shadow rays
+	CompileMaterials();
+
+	// one fixed hit on a surface facing upwards, hit at 45 degrees
+	HitPayload payload;
+	payload.hitDist = 1.0f;
+	payload.materialIndex = 0;
+	payload.WorldPos = glm::vec3(0.0f);
+	payload.WorldNorm = glm::vec3(0.0f, 1.0f, 0.0f);
+	const glm::vec3 incoming = glm::normalize(glm::vec3(1.0f, -1.0f, 0.0f));
+
+	std::vector<ShadingBenchmark> results;
+	uint32_t seed = 1;
+	glm::vec3 sink(0.0f); // summing up the results keeps the compiler from removing the loops
+
+	for (size_t i = 0; i < scene.Materials.size(); i++)
 	{
-		const Cube& cube = m_ActiveScene->Cubes[i];
+		const Material& material = scene.Materials[i];
+		ShadingBenchmark& result = results.emplace_back();
+		result.materialIndex = (int)i;
+		result.type = m_MaterialTypes[i];
 
-		float tMin = 0.0f; // Start of the ray
-		float tMax = std::numeric_limits<float>::max(); // Farthest intersection point
+		Walnut::Timer timer;
+		for (uint32_t n = 0; n < iterations; n++)
+		{
+			Ray ray{ glm::vec3(-1.0f, 1.0f, 0.0f), incoming };
+			glm::vec3 light(0.0f), throughput(1.0f);
+			ShadeGeneric(ray, payload, material, light, throughput, seed);
+			sink += ray.Direction + light + throughput;
+		}
+		result.genericNs = timer.ElapsedMillis() * 1e6f / (float)iterations;
 
-		// Iterate over each axis (x, y, z)
-		for (int i = 0; i < 3; ++i) {
-			float invD = 1.0f / ray.Direction[i];
-			float t0 = (cube.min[i] - ray.Origin[i]) * invD;
-			float t1 = (cube.max[i] - ray.Origin[i]) * invD;
+		timer.Reset();
+		for (uint32_t n = 0; n < iterations; n++)
+		{
+			Ray ray{ glm::vec3(-1.0f, 1.0f, 0.0f), incoming };
+			glm::vec3 light(0.0f), throughput(1.0f);
+			ShadeSpecialised(result.type, ray, payload, material, light, throughput, seed);
+			sink += ray.Direction + light + throughput;
+		}
+		result.specialisedNs = timer.ElapsedMillis() * 1e6f / (float)iterations;
+	}
 
-			if (invD < 0.0f) {
-				std::swap(t0, t1);
-			}
+	volatile float keep = sink.x + sink.y + sink.z;
+	(void)keep;
 
-			tMin = t0 > tMin ? t0 : tMin;
-			tMax = t1 < tMax ? t1 : tMax;
+	return results;
+}
 
-			if (tMax <= tMin) {
-				tMin = -1.0f; // No intersection
-				break;
-			}
+Renderer::Hit Renderer::TraceRay(const Ray& ray)
+{
+	Hit hit;
+
+	if (m_Settings.acceleration != Acceleration::BruteForce)
+	{
+		float hitDist;
+		uint32_t primitive;
+		// without the wide nodes (dropped for the memory budget) the binary tree is traversed
+		bool found = (m_Settings.acceleration == Acceleration::WideBVH && m_BVH.HasWideNodes())
+			? m_BVH.IntersectWide(ray, *m_ActiveScene, hitDist, primitive)
+			: m_BVH.IntersectBinary(ray, *m_ActiveScene, hitDist, primitive);
+
+		// the BVH numbers the primitives in the order of the primitive table
+		if (found)
+		{
+			hit.t = hitDist;
+			hit.primitive = m_Primitives.ids[primitive];
 		}
-		float tClosest = tMin;
+		return hit;
+	}
+
+	// one pass over the primitive table, every type range with its own intersection test
+	float hitDist = std::numeric_limits<float>::max(); // set hit distance to infinity
+	const std::vector<uint32_t>& ids = m_Primitives.ids;
+
+	for (uint32_t i = m_Primitives.RangeBegin(PrimitiveType::Sphere); i < m_Primitives.RangeEnd(PrimitiveType::Sphere); i++)
+	{
+		float tClosest = Intersection::Sphere(ray, m_ActiveScene->Spheres[PrimitiveId::Index(ids[i])]);
 		if (tClosest > 0.0f && tClosest < hitDist)
 		{
 			hitDist = tClosest;
-			closestCube = (int)i;
-			isCubeHit = true;
+			hit.primitive = ids[i];
 		}
 	}
 
-	if (isCubeHit)
+	for (uint32_t i = m_Primitives.RangeBegin(PrimitiveType::Cube); i < m_Primitives.RangeEnd(PrimitiveType::Cube); i++)
 	{
-		return NearestCubeHit(ray, hitDist, closestCube);
+		float tClosest = Intersection::Cube(ray, m_ActiveScene->Cubes[PrimitiveId::Index(ids[i])]);
+		if (tClosest > 0.0f && tClosest < hitDist)
+		{
+			hitDist = tClosest;
+			hit.primitive = ids[i];
+		}
 	}
-	else if (closestSphere >= 0)
+
+	if (hit.primitive != PrimitiveId::Invalid)
 	{
-		return NearestSphereHit(ray, hitDist, closestSphere);
+		hit.t = hitDist;
 	}
-	else
+	return hit;
+}
+
+Renderer::Hit Renderer::TracePrimaryRay(const Ray& ray, uint32_t x, uint32_t y)
+{
+	// a BVH beats walking a long list, only short lists replace the traversal
+	constexpr uint32_t MaxBinnedPrimitives = 32;
+
+	TileBins::Bin bin = m_TileBins.GetBin(x, y);
+	if (bin.count > MaxBinnedPrimitives && m_Settings.acceleration != Acceleration::BruteForce)
+		return TraceRay(ray);
+
+	// the list is in table order, so ties go to the same primitive as in the brute force loop
+	Hit hit;
+	float hitDist = std::numeric_limits<float>::max();
+	for (uint32_t i = 0; i < bin.count; i++)
 	{
-		return Missed(ray);
+		uint32_t id = bin.ids[i];
+		float tClosest = (PrimitiveId::Type(id) == PrimitiveType::Sphere)
+			? Intersection::Sphere(ray, m_ActiveScene->Spheres[PrimitiveId::Index(id)])
+			: Intersection::Cube(ray, m_ActiveScene->Cubes[PrimitiveId::Index(id)]);
+		if (tClosest > 0.0f && tClosest < hitDist)
+		{
+			hitDist = tClosest;
+			hit.primitive = id;
+		}
 	}
 
-	
-	//if (closestSphere < 0)
-		//return Missed(ray);
+	if (hit.primitive != PrimitiveId::Invalid)
+	{
+		hit.t = hitDist;
+	}
+	return hit;
+}
 
-	//return NearestHit(ray, hitDist, closestSphere);
-	
+Renderer::HitPayload Renderer::ReconstructHit(const Ray& ray, const Hit& hit)
+{
+	uint32_t index = PrimitiveId::Index(hit.primitive);
+	if (PrimitiveId::Type(hit.primitive) == PrimitiveType::Sphere)
+		return NearestSphereHit(ray, hit.t, (int)index);
+	return NearestCubeHit(ray, hit.t, (int)index);
 }
 
 Renderer::HitPayload Renderer::NearestSphereHit(const Ray& ray, float hitDist, int objectIndex)
 {
 	Renderer::HitPayload payload;
 	payload.hitDist = hitDist;
-	payload.objectIndex = objectIndex;
 	
 	const Sphere& closestSphere = m_ActiveScene->Spheres[objectIndex];
+	payload.materialIndex = closestSphere.MaterialIndex;
 	
 	glm::vec3 origin = ray.Origin - closestSphere.Position;
 
@@ -297,47 +1023,129 @@ Renderer::HitPayload Renderer::NearestCubeHit(const Ray& ray, float hitDist, int
 {
 	Renderer::HitPayload payload;
 	payload.hitDist = hitDist;
-	payload.objectIndex = objectIndex;
 
 	const Cube& closestCube = m_ActiveScene->Cubes[objectIndex];
+	payload.materialIndex = closestCube.MaterialIndex;
 	payload.WorldPos = ray.Origin + ray.Direction * hitDist;
 
+	// the face is the one the hit point is closest to, relative to the size of the cube.
+	// comparing with a fixed epsilon failed for large cubes and left the normal at 0
+	glm::vec3 center = (closestCube.min + closestCube.max) * 0.5f;
+	glm::vec3 halfSize = glm::max((closestCube.max - closestCube.min) * 0.5f, glm::vec3(1e-6f));
+	glm::vec3 local = (payload.WorldPos - center) / halfSize;
+	glm::vec3 distance = glm::abs(local);
 
 	glm::vec3 hitNormal(0.0f);
-	float alpha = 0.0001f; // i dont know why but without this it doesnt work; seems to be a fp-precision issue that is fixed by a offset
-
-	//here are the norrmals of the cube defined
-	if (glm::abs(payload.WorldPos.x - closestCube.min.x) < alpha)
-		hitNormal.x = -1.0f;
-	else if (glm::abs(payload.WorldPos.x - closestCube.max.x) < alpha)
-		hitNormal.x = 1.0f;
-	else if (glm::abs(payload.WorldPos.y - closestCube.min.y) < alpha)
-		hitNormal.y = -1.0f;
-	else if (glm::abs(payload.WorldPos.y - closestCube.max.y) < alpha)
-		hitNormal.y = 1.0f;
-	else if (glm::abs(payload.WorldPos.z - closestCube.min.z) < alpha)
-		hitNormal.z = -1.0f;
-	else if (glm::abs(payload.WorldPos.z - closestCube.max.z) < alpha)
-		hitNormal.z = 1.0f;
-
-	payload.WorldNorm = glm::normalize(hitNormal);
-
-	payload.isCube = true;
-	payload.materialIndex = closestCube.MaterialIndex;
+	if (distance.x >= distance.y && distance.x >= distance.z)
+		hitNormal.x = local.x > 0.0f ? 1.0f : -1.0f;
+	else if (distance.y >= distance.z)
+		hitNormal.y = local.y > 0.0f ? 1.0f : -1.0f;
+	else
+		hitNormal.z = local.z > 0.0f ? 1.0f : -1.0f;
 
+	payload.WorldNorm = hitNormal;
 	return payload;
 }
 
-Renderer::HitPayload Renderer::Missed(const Ray& ray)
+void Renderer::UpdatePrimitiveTable()
 {
-	Renderer::HitPayload payload;
-	payload.hitDist = -1.0f; // never hit anything
-	return payload;
+	if (m_PrimitivesScene == m_ActiveScene && m_Primitives.Matches(*m_ActiveScene))
+		return;
+
+	m_Primitives.Build(*m_ActiveScene);
+	m_PrimitivesScene = m_ActiveScene;
+	m_TileBinsDirty = true;
+}
+
+void Renderer::UpdateTileBins()
+{
+	m_LastBinningTime = 0.0f;
+	m_UseTileBins = m_Settings.TileBinning && !m_MemoryUsage.tileBinsDropped;
+	if (!m_UseTileBins)
+		return;
+
+	if (!m_TileBinsDirty && m_TileBinsScene == m_ActiveScene && m_TileBins.Matches(*m_ActiveCamera, m_Width, m_Height))
+		return;
+
+	Walnut::Timer timer;
+	m_TileBins.Build(*m_ActiveScene, m_Primitives, *m_ActiveCamera, m_Width, m_Height);
+	m_TileBinsScene = m_ActiveScene;
+	m_TileBinsDirty = false;
+	m_TileBinsSize = m_TileBins.GetMemorySize();
+	m_LastBinningTime = timer.ElapsedMillis();
+}
+
+void Renderer::UpdateMemoryUsage()
+{
+	MemoryUsage usage;
+
+	size_t pixels = (size_t)m_Width * m_Height;
+	usage.framebuffers = pixels * (sizeof(uint32_t) + sizeof(glm::vec4));
+	if (m_FinalImage)
+	{
+		usage.framebuffers += pixels * sizeof(uint32_t);
+	}
+
+	usage.rayCache = m_ActiveCamera->GetMemorySize();
+
+	const Scene& scene = *m_ActiveScene;
+	usage.scene = scene.Spheres.capacity() * sizeof(Sphere) + scene.Cubes.capacity() * sizeof(Cube)
+		+ scene.Materials.capacity() * sizeof(Material) + m_MaterialTypes.capacity() * sizeof(MaterialType);
+	if (scene.Environment)
+	{
+		usage.scene += scene.Environment->GetMemorySize();
+	}
+
+	usage.scheduling = (m_horizontalImgIterator.capacity() + m_verticalImgIterator.capacity() + m_TileIterator.capacity()
+		+ m_TileFrames.capacity() + m_ActiveTiles.capacity()) * sizeof(uint32_t) + m_TileSpiral.capacity() * sizeof(float);
+
+	auto accelerationSize = [this]() {
+		return m_BVH.GetMemorySize() + m_Primitives.ids.capacity() * sizeof(uint32_t) + m_TileBins.GetMemorySize();
+	};
+	usage.acceleration = accelerationSize();
+
+	if (m_Settings.MemoryBudgetMB > 0)
+	{
+		// what the optional caches take, or would take if they were not dropped
+		size_t tileBins = m_Settings.TileBinning ? std::max(m_TileBins.GetMemorySize(), m_TileBinsSize) : 0;
+		size_t rayCache = pixels * sizeof(glm::vec3);
+		size_t wideNodes = (m_Settings.acceleration == Acceleration::WideBVH) ? m_BVH.GetWideMemorySize() : 0;
+
+		size_t required = usage.Total() - m_TileBins.GetMemorySize() - usage.rayCache
+			- (m_BVH.HasWideNodes() ? m_BVH.GetWideMemorySize() : 0);
+		size_t budget = (size_t)m_Settings.MemoryBudgetMB << 20;
+
+		// the caches are given up one after the other until the rest fits
+		size_t total = required + tileBins + rayCache + wideNodes;
+		usage.tileBinsDropped = total > budget && tileBins > 0;
+		if (usage.tileBinsDropped)
+			total -= tileBins;
+		usage.rayCacheDropped = total > budget;
+		if (usage.rayCacheDropped)
+			total -= rayCache;
+		usage.wideBVHDropped = total > budget && wideNodes > 0;
+		if (usage.wideBVHDropped)
+			total -= wideNodes;
+		usage.overBudget = total > budget;
+
+		if (usage.tileBinsDropped)
+		{
+			m_TileBins.Release();
+			m_TileBinsDirty = true;
+		}
+		if (usage.wideBVHDropped)
+		{
+			m_BVH.ReleaseWideNodes();
+		}
+		usage.acceleration = accelerationSize();
+	}
+
+	m_MemoryUsage = usage;
 }
 
-glm::vec3 Renderer::ReflectRay(const glm::vec3& incomingRay, const glm::vec3& normal, float roughness, float metallic) {
+glm::vec3 Renderer::ReflectRay(const glm::vec3& incomingRay, const glm::vec3& normal, float roughness, float metallic, uint32_t& seed) {
 	glm::vec3 reflectedRay = glm::reflect(incomingRay, normal); // Perfect mirror reflection
-	glm::vec3 diffuseRay = glm::normalize(normal + Walnut::Random::InUnitSphere()); // Lambertian reflection
+	glm::vec3 diffuseRay = glm::normalize(normal + Utils::InUnitSphere(seed)); // Lambertian reflection
 
 	// Interpolate based on the metallic value
 	// glm::mix does a linear interpolation with the factor metallic between vectors reflected Ray and diffused Ray
@@ -346,15 +1154,22 @@ glm::vec3 Renderer::ReflectRay(const glm::vec3& incomingRay, const glm::vec3& no
 
 void Renderer::onResize(uint32_t width, uint32_t height)
 {
-	if (m_FinalImage) // if the image doesnt exist create a new one
-	{
-		if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height) // if image is right size, abort
-			return;
-		m_FinalImage->Resize(width, height);
-	}
-	else
+	if (m_ImageData && m_Width == width && m_Height == height) // if image is right size, abort
+		return;
+	m_Width = width;
+	m_Height = height;
+
+	// without a window there is no image on the gpu, the pixels only live in m_ImageData
+	if (!m_Headless)
 	{
-		m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+		if (m_FinalImage) // if the image doesnt exist create a new one
+		{
+			m_FinalImage->Resize(width, height);
+		}
+		else
+		{
+			m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+		}
 	}
 
 	m_verticalImgIterator.resize(height);
@@ -368,10 +1183,158 @@ void Renderer::onResize(uint32_t width, uint32_t height)
 		m_verticalImgIterator[i] = i;
 	}
 
+	m_TilesX = (width + TileBins::TileSize - 1) >> TileBins::TileShift;
+	m_TilesY = (height + TileBins::TileSize - 1) >> TileBins::TileShift;
+	m_TileIterator.resize(m_TilesX * m_TilesY);
+	std::iota(m_TileIterator.begin(), m_TileIterator.end(), 0);
+	m_TileFramesValid = false;
+	m_TileSpiralDirty = true;
+
 	delete[] m_ImageData;
 	m_ImageData = new uint32_t[height * width]; // the rgba format uses 1 byte per channel so 1px = 1 uint32_T
 
-	delete[] m_AccumulationData;
+	// the file keeps its samples at its own size, opening it again would start it over at the new one
+	if (m_Checkpoint.IsOpen())
+	{
+		m_Checkpoint.Close();
+		m_AccumulationData = nullptr; // was mapped from the file
+		m_CheckpointNotice = "checkpointing stopped, " + m_CheckpointPath + " keeps the render at its old size";
+		m_CheckpointPath.clear();
+	}
+
+	AllocateAccumulation(width, height);
+	PlaceBuffers();
+}
+
+void Renderer::UpdateThreadPool()
+{
+	bool wanted = m_Settings.Multithreading && m_Settings.NumaPinning;
+	if (wanted == (m_ThreadPool != nullptr))
+		return;
+
+	m_ThreadPool.reset();
+	if (!wanted)
+		return;
+
+	m_ThreadPool = std::make_unique<NumaThreadPool>(NumaTopology::Get());
+
+	// the pages of the current buffers are on whatever node touched them first, new ones are placed properly.
+	// the pages of a checkpoint belong to the file and keep their samples
+	if (m_ImageData)
+	{
+		delete[] m_ImageData;
+		m_ImageData = new uint32_t[m_Height * m_Width];
+		if (!m_Checkpoint.IsOpen())
+		{
+			delete[] m_AccumulationData;
+			m_AccumulationData = new glm::vec4[m_Height * m_Width];
+			m_FrameCount = 1;
+		}
+		PlaceBuffers();
+	}
+}
+
+void Renderer::PlaceBuffers()
+{
+	if (!m_ThreadPool)
+		return;
+
+	// new[] only reserves the memory, the pages are allocated by the first write to them
+	bool heapAccumulation = !m_Checkpoint.IsOpen();
+	m_ThreadPool->ForEachRow(m_Height, [this, heapAccumulation](uint32_t y) {
+		memset(&m_ImageData[y * m_Width], 0, m_Width * sizeof(uint32_t));
+		if (heapAccumulation)
+		{
+			memset(&m_AccumulationData[y * m_Width], 0, m_Width * sizeof(glm::vec4));
+		}
+	});
+}
+
+void Renderer::AllocateAccumulation(uint32_t width, uint32_t height)
+{
+	// the mapped memory belongs to the checkpoint file, only the heap buffer is deleted
+	if (!m_Checkpoint.IsOpen())
+		delete[] m_AccumulationData;
+	m_AccumulationData = nullptr;
+
+	if (!m_CheckpointPath.empty())
+	{
+		std::string error;
+		Checkpoint::OpenResult result = m_Checkpoint.Open(m_CheckpointPath, width, height, std::random_device()(), m_CheckpointOverwrite, error);
+		if (result != Checkpoint::OpenResult::Failed)
+		{
+			m_Checkpoint.SetFlushInterval(m_CheckpointFlushInterval);
+			m_AccumulationData = m_Checkpoint.GetAccumulation();
+
+			// continue with the samples and random numbers of the file
+			m_FrameCount = m_Checkpoint.GetHeader().frameCount;
+			m_RunSeed = m_Checkpoint.GetHeader().runSeed;
+			m_CheckpointNeedsValidation = (result == Checkpoint::OpenResult::Resumed);
+			return;
+		}
+		m_CheckpointNotice = error;
+		m_CheckpointPath.clear();
+	}
+
 	m_AccumulationData = new glm::vec4[height * width];
-	
+	m_FrameCount = 1;
+}
+
+Checkpoint::OpenResult Renderer::EnableCheckpoint(const std::string& path, float flushInterval, bool overwrite)
+{
+	DisableCheckpoint();
+
+	m_CheckpointNotice.clear();
+	m_CheckpointPath = path;
+	m_CheckpointFlushInterval = flushInterval;
+	m_CheckpointOverwrite = overwrite;
+	if (!m_ImageData)
+		return Checkpoint::OpenResult::Created; // opened by the first onResize
+
+	AllocateAccumulation(m_Width, m_Height);
+	if (!m_Checkpoint.IsOpen())
+		return Checkpoint::OpenResult::Failed;
+	return m_CheckpointNeedsValidation ? Checkpoint::OpenResult::Resumed : Checkpoint::OpenResult::Created;
+}
+
+void Renderer::DisableCheckpoint()
+{
+	if (!m_Checkpoint.IsOpen())
+	{
+		m_CheckpointPath.clear();
+		return;
+	}
+
+	// keep the samples, they are copied back to the heap before the file is closed
+	const size_t pixelCount = (size_t)m_Width * m_Height;
+	glm::vec4* accumulation = new glm::vec4[pixelCount];
+	memcpy(accumulation, m_AccumulationData, pixelCount * sizeof(glm::vec4));
+
+	m_Checkpoint.Close();
+	m_CheckpointPath.clear();
+	m_AccumulationData = accumulation;
+	// m_RunSeed stays the one of the checkpoint, the render goes on with the same random numbers
+}
+
+void Renderer::ValidateCheckpoint()
+{
+	Checkpoint::Header& header = m_Checkpoint.GetHeader();
+
+	if (m_FrameCount == 1)
+	{
+		// a new render starts, the file now belongs to this scene and camera
+		header.sceneHash = Utils::HashScene(*m_ActiveScene);
+		header.cameraHash = Utils::HashCamera(*m_ActiveCamera);
+		header.frameCount = 1;
+	}
+	else if (m_CheckpointNeedsValidation)
+	{
+		// samples of another scene or camera must not be mixed in, start over instead
+		if (header.sceneHash != Utils::HashScene(*m_ActiveScene) || header.cameraHash != Utils::HashCamera(*m_ActiveCamera))
+		{
+			m_FrameCount = 1;
+			ValidateCheckpoint();
+		}
+	}
+	m_CheckpointNeedsValidation = false;
 }
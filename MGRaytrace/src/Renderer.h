@@ -1,80 +1,375 @@
 #pragma once
 
 #include "Walnut/Image.h"
+#include "BVH.h"
 #include "Camera.h"
+#include "Checkpoint.h"
+#include "NumaThreadPool.h"
+#include "Primitive.h"
 #include "Ray.h"
 #include "Scene.h"
+#include "TileBins.h"
 #include <memory> // required for shared ptrs
+#include <string>
+#include <vector>
 #include <glm/glm.hpp>
 
 class Renderer
 {
 public:
+	// how TraceRay finds the closest primitive
+	enum class Acceleration
+	{
+		BruteForce = 0,	// test every sphere and every cube
+		BinaryBVH,		// classic two child BVH built with the SAH
+		WideBVH			// the same tree collapsed to four children per node, tested with SSE
+	};
+
 	struct Settings
 	{
 		bool ambientOcclusion = true;
 		bool Accumulate = true;
 		bool Multithreading = true;
+		bool SpecialisedShading = true; // use the per material variant shading instead of the general one
+		Acceleration acceleration = Acceleration::WideBVH;
+		BVH::BuildMethod buildMethod = BVH::BuildMethod::SAH;
+		float RebuildThreshold = 1.5f; // rebuild once a refitted BVH is this much more expensive than a fresh one
+		bool NumaPinning = false; // render on threads pinned to the NUMA nodes, every node keeps its rows in its own memory
+		bool TileBinning = true; // primary rays only test the primitives projected into their screen tile, the frame is rendered tile by tile
+		bool PriorityTiles = false; // tiles close to the focus get rendered first and more often, see SetFocus
+		float PriorityBudgetMs = 30.0f; // the priority scheduler keeps rendering tiles until a frame took this long
+		float PriorityFalloff = 0.5f; // how much less often a tile is rendered per ring of tiles away from the focus
+		uint32_t SamplesPerFrame = 1; // above 1 the samples of a frame are stratified, jittered and tent filtered (anti aliasing)
+		uint32_t MemoryBudgetMB = 0; // 0 is unlimited, above the budget the optional caches are dropped (see MemoryUsage)
+	};
+
+	// what happened to the BVH during the last frame
+	enum class BuildKind
+	{
+		None = 0,
+		Refit,
+		Rebuild
+	};
+
+	struct AccelerationBenchmark
+	{
+		Acceleration acceleration;
+		float buildMs;
+		float frameMs; // average over all rendered frames
+	};
+
+	// bytes held for rendering, split by what they are used for.
+	// only the optional caches can be given up for the memory budget, in this order: the tile bins
+	// (primary rays traverse the BVH), the ray directions of the camera (computed per ray) and the
+	// wide BVH nodes (the binary tree is traversed instead). the rest is needed for every frame
+	struct MemoryUsage
+	{
+		size_t framebuffers = 0;	// RGBA image, accumulation (heap or checkpoint mapping) and the upload buffer of the gpu image
+		size_t rayCache = 0;		// ray directions cached by the camera
+		size_t scene = 0;			// primitives, materials and environment map
+		size_t acceleration = 0;	// BVH, primitive table and tile bins
+		size_t scheduling = 0;		// row and tile iterators, frame counts and spiral of the tiles
+
+		bool tileBinsDropped = false;
+		bool rayCacheDropped = false;
+		bool wideBVHDropped = false;
+		bool overBudget = false;	// even without the optional caches
+
+		size_t Total() const { return framebuffers + rayCache + scene + acceleration + scheduling; }
+	};
+
+	// timings of one material shaded by the general and by the specialised function
+	struct ShadingBenchmark
+	{
+		int materialIndex;
+		MaterialType type;
+		float genericNs;	 // nanoseconds per shading call
+		float specialisedNs;
 	};
 
 public:
 
-	Renderer() = default;
+	// a headless renderer does not create an image on the gpu, it is used without a window
+	explicit Renderer(bool headless = false)
+		: m_Headless(headless)
+	{
+	}
+	~Renderer();
 
 
 	void onResize(uint32_t width, uint32_t height);
 
 	void Render(const Scene& scene, const Camera& camera);
 
+	// renders the frames firstFrame .. firstFrame + frameCount - 1 (counted from 1 like m_FrameCount) of the
+	// pixels inside the region and adds them to sums, which holds regionWidth * regionHeight pixels.
+	// a pixel gets the same random numbers as in Render, so regions rendered on their own give
+	// exactly the same image as one full render. the camera has to have the size of onResize
+	void RenderRegion(const Scene& scene, const Camera& camera, uint32_t regionX, uint32_t regionY, uint32_t regionWidth, uint32_t regionHeight,
+		uint32_t firstFrame, uint32_t frameCount, glm::vec4* sums);
+
 	std::shared_ptr<Walnut::Image> GetFinalImage() const 
 	{
 		return m_FinalImage;
 	};
 
+	uint32_t GetWidth() const { return m_Width; }
+	uint32_t GetHeight() const { return m_Height; }
+
+	// the final RGBA pixels of the last frame and the sums of all accumulated frames
+	const uint32_t* GetImageData() const { return m_ImageData; }
+	const glm::vec4* GetAccumulationData() const { return m_AccumulationData; }
+
 	void FrameCountReset()
 	{
 		m_FrameCount = 1;
+		m_TileFramesValid = false;
+	}
+
+	// only the tiles overlapping the rectangle (in pixels of the image) are rendered, the others keep
+	// their samples and their image. every tile counts its own samples, so the region can be moved
+	// around without a reset. a width or height of 0 renders the whole image again
+	void SetRegionOfInterest(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+	{
+		m_RegionOfInterest = { x, y, width, height };
+	}
+	bool HasRegionOfInterest() const { return m_RegionOfInterest.z > 0 && m_RegionOfInterest.w > 0; }
+	glm::uvec4 GetRegionOfInterest() const { return m_RegionOfInterest; }
+
+	// the pixel the priority scheduler spirals out from, e.g. the mouse or the projected center of the selected object
+	void SetFocus(uint32_t x, uint32_t y)
+	{
+		if (x != m_Focus.x || y != m_Focus.y)
+			m_TileSpiralDirty = true;
+		m_Focus = { x, y };
+	}
+
+	// only renders the tiles the primitives with this material cover on the screen (needs TileBinning), -1 turns it off.
+	// reflections of the material elsewhere keep their old samples
+	void SetFocusMaterial(int materialIndex) { m_FocusMaterial = materialIndex; }
+	int GetFocusMaterial() const { return m_FocusMaterial; }
+
+	// after an edit of the material: focuses on it and restarts only the tiles showing it, the other tiles keep
+	// their samples and frame counts. without tile frames (no TileBinning or a checkpoint) the whole image starts over
+	void ResetMaterialTiles(int materialIndex)
+	{
+		m_FocusMaterial = materialIndex;
+		m_ResetFocusTiles = true;
 	}
 
 	Settings& GetSettings()
 	{
 		return m_Settings;
 	}
+
+	// renders with the same seed give exactly the same pixels, an enabled checkpoint brings its own
+	void SetRunSeed(uint32_t seed) { m_RunSeed = seed; }
+	uint32_t GetRunSeed() const { return m_RunSeed; }
+
+	// number of frames in the accumulation buffer
+	uint32_t GetAccumulatedFrames() const { return m_FrameCount - 1; }
+
+	// keeps the accumulation buffer in a memory mapped file which is written to the disk every
+	// flushInterval seconds. if the file holds a render of the same scene, camera and size it is resumed.
+	// an existing file of another size or which is no checkpoint is only replaced with overwrite, otherwise
+	// this fails. a resize closes the file at its size and goes on without it, GetCheckpointNotice tells why
+	Checkpoint::OpenResult EnableCheckpoint(const std::string& path, float flushInterval, bool overwrite = false);
+	void DisableCheckpoint();
+	bool IsCheckpointing() const { return m_Checkpoint.IsOpen(); }
+	const std::string& GetCheckpointNotice() const { return m_CheckpointNotice; }
+
+	// has to be called after primitives of the scene were moved, added or removed
+	void OnSceneChanged()
+	{
+		m_BVHDirty = true;
+		m_TileBinsDirty = true;
+	}
+
+	// takes over a BVH which was built for the scene somewhere else (e.g. by the SceneLoader)
+	void AdoptAccelerationStructure(BVH&& bvh, const Scene& scene)
+	{
+		m_BVH = std::move(bvh);
+		m_BVHScene = &scene;
+		m_BVHPrimitiveCount = scene.Spheres.size() + scene.Cubes.size();
+		m_BVHDirty = false;
+		m_TileBinsDirty = true;
+	}
+
+	// what the last Render or RenderRegion call used
+	const MemoryUsage& GetMemoryUsage() const { return m_MemoryUsage; }
+
+	// false while the memory budget has no room for the ray directions, the owner of the
+	// camera passes this on to Camera::SetRayDirectionCache before the next frame
+	bool WantsRayDirectionCache() const { return !m_MemoryUsage.rayCacheDropped; }
+
+	// rows and time of every NUMA node during the last Render call, empty without NumaPinning
+	std::vector<NumaThreadPool::NodeStatistics> GetNodeStatistics() const
+	{
+		return m_ThreadPool ? m_ThreadPool->GetStatistics() : std::vector<NumaThreadPool::NodeStatistics>();
+	}
+
+	// time spent on the BVH and on tracing the pixels during the last Render call
+	float GetLastBuildTime() const { return m_LastBuildTime; }
+	float GetLastTraceTime() const { return m_LastTraceTime; }
+	BuildKind GetLastBuildKind() const { return m_LastBuildKind; }
+
+	// time of the last rebuild of the tile bins and how many primitives a tile lists on average
+	float GetLastBinningTime() const { return m_LastBinningTime; }
+	float GetAverageBinSize() const { return m_UseTileBins ? m_TileBins.GetAverageBinSize() : 0.0f; }
+
+	// shades every material of the scene a fixed number of times with both
+	// shading paths and returns the time per call for each of them
+	std::vector<ShadingBenchmark> BenchmarkShading(const Scene& scene, uint32_t iterations = 200000);
+
+	// renders the scene with every acceleration structure and returns the build and frame times.
+	// runs on a separate renderer with the same settings and size, this one is not touched
+	std::vector<AccelerationBenchmark> BenchmarkAcceleration(const Scene& scene, const Camera& camera, uint32_t frames = 16) const;
 private:
+	// what TraceRay returns: just enough to find the surface again. the position and normal
+	// are only computed (ReconstructHit) for hits which get shaded, shadow rays never need them
+	struct Hit
+	{
+		float t = -1.0f; // negative if nothing was hit
+		uint32_t primitive = PrimitiveId::Invalid;
+	};
+
+	// the surface at a shaded hit
 	struct HitPayload
 	{
 		float hitDist;
-		int objectIndex;
 		int materialIndex;
 		glm::vec3 WorldNorm;
 		glm::vec3 WorldPos;
-		bool isCube = false;
 	};
 
 	// this is going to implement a raygen shader similar to vulkan
-	glm::vec4 PerPixel(uint32_t x, uint32_t y);
+	glm::vec4 PerPixel(uint32_t x, uint32_t y, uint32_t frameSeed);
+	// follows one path from the camera, x and y pick the tile bins of the primary ray. seed is the state of the random numbers of the pixel
+	glm::vec3 TracePath(Ray& ray, uint32_t x, uint32_t y, uint32_t& seed);
+	void RenderRow(uint32_t y);
+	void RenderTile(uint32_t tile);
+	void RenderPixel(uint32_t x, uint32_t y, uint32_t frameSeed, uint32_t frameCount);
+	void GetTileBounds(uint32_t tile, uint32_t& minX, uint32_t& minY, uint32_t& maxX, uint32_t& maxY) const;
 
+	// region of interest, focus material and priority scheduling: every tile has its own frame count
+	bool UseTileFrames() const;
+	void RenderTileFrames();
+	void RenderTileFrame(uint32_t tile);
+	// goes back to one frame count for the whole image, the tiles have to agree on it or the render starts over
+	void LeaveTileFrames();
+	void CollectActiveTiles();
+	bool TileShowsMaterial(uint32_t tile, int materialIndex) const;
+	void UpdateTileSpiral();
+
+	HitPayload ReconstructHit(const Ray& ray, const Hit& hit);
 	Renderer::HitPayload Renderer::NearestSphereHit(const Ray& ray, float hitDist, int objectIndex);
 	Renderer::HitPayload Renderer::NearestCubeHit(const Ray& ray, float hitDist, int objectIndex);
 
 	//HitPayload NearestHit(const Ray& ray, float hitDist, int objectIndex);
-	HitPayload Missed(const Ray& ray);
-	HitPayload TraceRay(const Ray& ray);
+	Hit TraceRay(const Ray& ray);
+	// the same for a ray from the camera through pixel x, y: only tests the list of its tile
+	Hit TracePrimaryRay(const Ray& ray, uint32_t x, uint32_t y);
+
+	glm::vec3 Renderer::ReflectRay(const glm::vec3& incomingRay, const glm::vec3& normal, float roughness, float metallic, uint32_t& seed);
+	void RefractRay(Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& throughput);
+
+	// next event estimation: adds the light of one direction picked from the environment map,
+	// weighted against the chance of the diffuse bounce finding the same direction (MIS)
+	void SampleEnvironment(const HitPayload& payload, glm::vec3& light, const glm::vec3& throughput, uint32_t& seed);
+
+	void UpdateAccelerationStructure();
+
+	// allocates the accumulation buffer, either on the heap or inside the checkpoint file
+	void AllocateAccumulation(uint32_t width, uint32_t height);
 
-	glm::vec3 Renderer::ReflectRay(const glm::vec3& incomingRay, const glm::vec3& normal, float roughness, float metallic);
+	// starts or stops the pinned threads when NumaPinning changed
+	void UpdateThreadPool();
+	// touches the rows of the new buffers first from the node which renders them, so their pages are allocated there
+	void PlaceBuffers();
+	void ValidateCheckpoint();
+
+	// sorts every material of the active scene into its shading variant
+	void CompileMaterials();
+	// lists the primitives of the active scene again if they were added or removed
+	void UpdatePrimitiveTable();
+	// projects the primitives into the screen tiles again if the camera or the scene moved
+	void UpdateTileBins();
+	// counts the bytes of everything and decides which optional caches fit into the budget
+	void UpdateMemoryUsage();
+
+	// shading of one hit: adds the emitted light, updates the throughput and sets up the next ray.
+	// seed is the state of the random numbers of this pixel
+	template<MaterialType Type>
+	void Shade(Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& light, glm::vec3& throughput, uint32_t& seed);
+	void ShadeSpecialised(MaterialType type, Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& light, glm::vec3& throughput, uint32_t& seed);
+	void ShadeGeneric(Ray& ray, const HitPayload& payload, const Material& material, glm::vec3& light, glm::vec3& throughput, uint32_t& seed);
 
 private:
 	std::shared_ptr<Walnut::Image> m_FinalImage;
+	bool m_Headless = false;
+	uint32_t m_Width = 0;
+	uint32_t m_Height = 0;
 
 	const Scene* m_ActiveScene = nullptr;
 	const Camera* m_ActiveCamera = nullptr;
+	const EnvironmentMap* m_Environment = nullptr; // of the active scene, null if it has none or the sky is turned off
 
 	Settings m_Settings;
 
 	std::vector<uint32_t> m_horizontalImgIterator;
 	std::vector<uint32_t> m_verticalImgIterator;
+	std::vector<uint32_t> m_TileIterator;
+	uint32_t m_TilesX = 0;
+	uint32_t m_TilesY = 0;
+
+	std::vector<uint32_t> m_TileFrames; // frames accumulated in every tile while rendering with tile frames
+	bool m_TileFramesValid = false;
+	std::vector<uint32_t> m_ActiveTiles;
+	std::vector<float> m_TileSpiral; // ring around the focus plus the angle as fraction, the order of the spiral
+	bool m_TileSpiralDirty = true;
+	glm::uvec4 m_RegionOfInterest{ 0 }; // x, y, width, height
+	glm::uvec2 m_Focus{ 0xFFFFFFFF, 0xFFFFFFFF }; // outside of the image means the center
+	int m_FocusMaterial = -1;
+	bool m_ResetFocusTiles = false; // set by ResetMaterialTiles, done by the next frame
+
+	std::unique_ptr<NumaThreadPool> m_ThreadPool; // only while NumaPinning is on
+
+	PrimitiveTable m_Primitives;
+	const Scene* m_PrimitivesScene = nullptr; // the scene m_Primitives was built for
+
+	TileBins m_TileBins;
+	const Scene* m_TileBinsScene = nullptr;
+	bool m_TileBinsDirty = true;
+	bool m_UseTileBins = false; // TileBinning is on and the bins are up to date for this frame
+	float m_LastBinningTime = 0.0f;
+	size_t m_TileBinsSize = 0; // of the last build, to know what the bins would take after dropping them
+
+	MemoryUsage m_MemoryUsage;
+
+	std::vector<MaterialType> m_MaterialTypes; // shading variant of each material, same order as Scene::Materials
+
+	BVH m_BVH;
+	const Scene* m_BVHScene = nullptr; // the scene the BVH was built for
+	size_t m_BVHPrimitiveCount = 0;
+	bool m_BVHDirty = true;
+
+	float m_LastBuildTime = 0.0f;
+	float m_LastTraceTime = 0.0f;
+	BuildKind m_LastBuildKind = BuildKind::None;
 
 	uint32_t* m_ImageData = nullptr;
 	glm::vec4* m_AccumulationData = nullptr;
 	uint32_t m_FrameCount = 1; // this is the count of how many frames have been rendered for the avg
+
+	// the random numbers of a pixel only depend on its position, the frame and this seed,
+	// so a render can be resumed or continued on another machine with different numbers
+	uint32_t m_RunSeed = 0;
+	uint32_t m_FrameSeed = 0;
+
+	Checkpoint m_Checkpoint;
+	std::string m_CheckpointPath;
+	float m_CheckpointFlushInterval = 30.0f;
+	bool m_CheckpointOverwrite = false;
+	std::string m_CheckpointNotice; // why checkpointing stopped on its own or could not start, empty if it did not
+	bool m_CheckpointNeedsValidation = false; // a resumed checkpoint still has to be compared to the scene and camera
 };
\ No newline at end of file
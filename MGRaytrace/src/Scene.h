@@ -1,7 +1,35 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
 
+class EnvironmentMap;
+
+// the shading variants a material gets sorted into before a frame is rendered.
+// every variant has its own specialised shading function so the bounce loop
+// only does the work (and draws the random numbers) this kind of surface needs
+enum class MaterialType
+{
+	Diffuse,	// metallic == 0, only the lambertian bounce
+	Mirror,		// metallic == 1, only the perfect reflection (no random numbers at all)
+	Glossy,		// 0 < metallic < 1, blend between the diffuse and the reflected ray
+	Dielectric,	// transparency > 0, refraction with total internal reflection
+	Emissive	// emits light, falls back to the full general shading path
+};
+
+inline const char* MaterialTypeName(MaterialType type)
+{
+	switch (type)
+	{
+	case MaterialType::Diffuse:		return "Diffuse";
+	case MaterialType::Mirror:		return "Mirror";
+	case MaterialType::Glossy:		return "Glossy";
+	case MaterialType::Dielectric:	return "Dielectric";
+	case MaterialType::Emissive:	return "Emissive";
+	}
+	return "Unknown";
+}
+
 struct Material
 {
 	glm::vec3 Albedo{ 1.0f };
@@ -18,6 +46,21 @@ struct Material
 	{
 		return emissionCol * emissionPow;
 	}
+
+	// sort the material into one of the shading variants above.
+	// emission is checked first as the emissive variant covers everything else too
+	MaterialType Classify() const
+	{
+		if (emissionPow > 0.0f && (emissionCol.r > 0.0f || emissionCol.g > 0.0f || emissionCol.b > 0.0f))
+			return MaterialType::Emissive;
+		if (transparency > 0.0f)
+			return MaterialType::Dielectric;
+		if (metallic <= 0.0f)
+			return MaterialType::Diffuse;
+		if (metallic >= 1.0f)
+			return MaterialType::Mirror;
+		return MaterialType::Glossy;
+	}
 };
 
 struct Cube {
@@ -61,4 +104,7 @@ struct Scene
 	std::vector<Cube> Cubes;
 	std::vector<Sphere> Spheres;
 	std::vector<Material> Materials;
+
+	// lights the rays which leave the scene, without one they get the constant sky color
+	std::shared_ptr<EnvironmentMap> Environment;
 };
\ No newline at end of file
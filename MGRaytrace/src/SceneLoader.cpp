@@ -0,0 +1,399 @@
+#include "SceneLoader.h"
+
+#include "EnvironmentMap.h"
+
+#include <fstream>
+#include <sstream>
+
+SceneLoader::~SceneLoader()
+{
+	// the task works on its own data, but it must not outlive the progress counters
+	if (m_Task.valid())
+		m_Task.wait();
+}
+
+bool SceneLoader::LoadAsync(const std::string& path, BVH::BuildMethod buildMethod)
+{
+	if (m_Task.valid())
+		return false;
+
+	m_Error.clear();
+	m_Progress = 0.0f;
+	m_Stage = Stage::Parsing;
+
+	m_Task = std::async(std::launch::async, [this, path, buildMethod]() -> std::unique_ptr<LoadedScene> {
+		auto loaded = std::make_unique<LoadedScene>();
+
+		// the parser reports the first 80% of the progress, the BVH build the rest
+		if (!ParseFile(path, loaded->scene, m_TaskError, &m_Progress))
+		{
+			m_Stage = Stage::Failed;
+			return nullptr;
+		}
+
+		m_Stage = Stage::Materials;
+		Scene& scene = loaded->scene;
+		Sanitize(scene);
+		m_Progress = 0.85f;
+
+		m_Stage = Stage::Building;
+		loaded->bvh.Build(scene, buildMethod);
+		m_Progress = 1.0f;
+
+		m_Stage = Stage::Done;
+		return loaded;
+	});
+
+	return true;
+}
+
+const char* SceneLoader::GetStageName() const
+{
+	switch (m_Stage.load())
+	{
+	case Stage::Idle:		return "Idle";
+	case Stage::Parsing:	return "Parsing";
+	case Stage::Materials:	return "Setting up materials";
+	case Stage::Building:	return "Building BVH";
+	case Stage::Done:		return "Done";
+	case Stage::Failed:		return "Failed";
+	}
+	return "";
+}
+
+std::unique_ptr<LoadedScene> SceneLoader::TakeLoadedScene()
+{
+	if (!m_Task.valid() || m_Task.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return nullptr;
+
+	std::unique_ptr<LoadedScene> loaded = m_Task.get();
+	if (!loaded)
+	{
+		m_Error = m_TaskError;
+	}
+	return loaded;
+}
+
+bool SceneLoader::LoadFromFile(const std::string& path, Scene& scene, std::string& error, std::atomic<float>* progress)
+{
+	if (!ParseFile(path, scene, error, progress))
+		return false;
+
+	Sanitize(scene);
+	return true;
+}
+
+void SceneLoader::Sanitize(Scene& scene)
+{
+	if (scene.Materials.empty())
+	{
+		scene.Materials.emplace_back(); // everything needs at least one material
+	}
+	const int lastMaterial = (int)scene.Materials.size() - 1;
+	for (Sphere& sphere : scene.Spheres)
+	{
+		sphere.MaterialIndex = glm::clamp(sphere.MaterialIndex, 0, lastMaterial);
+	}
+	for (Cube& cube : scene.Cubes)
+	{
+		cube.MaterialIndex = glm::clamp(cube.MaterialIndex, 0, lastMaterial);
+	}
+}
+
+bool SceneLoader::ParseFile(const std::string& path, Scene& scene, std::string& error, std::atomic<float>* progress)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		error = "could not open " + path;
+		return false;
+	}
+
+	const float fileSize = (float)file.tellg();
+	file.seekg(0);
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		if (progress && (lineNumber % 1024) == 0 && fileSize > 0.0f)
+		{
+			*progress = 0.8f * (float)file.tellg() / fileSize;
+		}
+
+		std::istringstream stream(line);
+		std::string type;
+		if (!(stream >> type) || type[0] == '#')
+			continue;
+
+		bool ok = false;
+		if (type == "material")
+		{
+			Material material;
+			std::string name;
+			ok = (bool)(stream >> name
+				>> material.Albedo.r >> material.Albedo.g >> material.Albedo.b
+				>> material.roughness >> material.metallic >> material.transparency >> material.refractiveIndex
+				>> material.emissionCol.r >> material.emissionCol.g >> material.emissionCol.b >> material.emissionPow);
+			name.copy(material.name, sizeof(material.name) - 1);
+			scene.Materials.push_back(material);
+		}
+		else if (type == "sphere")
+		{
+			Sphere sphere;
+			ok = (bool)(stream >> sphere.Position.x >> sphere.Position.y >> sphere.Position.z >> sphere.radius >> sphere.MaterialIndex);
+			scene.Spheres.push_back(sphere);
+		}
+		else if (type == "cube")
+		{
+			glm::vec3 min, max;
+			int materialIndex = 0;
+			ok = (bool)(stream >> min.x >> min.y >> min.z >> max.x >> max.y >> max.z >> materialIndex);
+			Cube cube(glm::min(min, max), glm::max(min, max));
+			cube.MaterialIndex = materialIndex;
+			scene.Cubes.push_back(cube);
+		}
+
+		else if (type == "environment")
+		{
+			std::string imagePath;
+			float intensity = 1.0f;
+			ok = (bool)(stream >> imagePath >> intensity);
+			if (ok)
+			{
+				auto environment = std::make_shared<EnvironmentMap>();
+				if (!environment->Load(imagePath, error))
+				{
+					error = path + ":" + std::to_string(lineNumber) + ": " + error;
+					return false;
+				}
+				environment->Intensity = intensity;
+				scene.Environment = std::move(environment);
+			}
+		}
+
+		if (!ok)
+		{
+			error = path + ":" + std::to_string(lineNumber) + ": could not read \"" + line + "\"";
+			return false;
+		}
+	}
+
+	if (progress)
+	{
+		*progress = 0.8f;
+	}
+	return true;
+}
+
+bool SceneLoader::SaveToFile(const std::string& path, const Scene& scene)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	file << "# material <name> <albedo r g b> <roughness> <metallic> <transparency> <refractive index> <emission r g b> <emission power>\n";
+	for (size_t i = 0; i < scene.Materials.size(); i++)
+	{
+		const Material& m = scene.Materials[i];
+		// materials without a name get their index, the name must not be empty or contain spaces
+		std::string name = m.name[0] ? std::string(m.name) : "material" + std::to_string(i);
+		for (char& c : name)
+		{
+			if (c == ' ')
+				c = '_';
+		}
+		file << "material " << name << " "
+			<< m.Albedo.r << " " << m.Albedo.g << " " << m.Albedo.b << " "
+			<< m.roughness << " " << m.metallic << " " << m.transparency << " " << m.refractiveIndex << " "
+			<< m.emissionCol.r << " " << m.emissionCol.g << " " << m.emissionCol.b << " " << m.emissionPow << "\n";
+	}
+
+	file << "# sphere <position x y z> <radius> <material index>\n";
+	for (const Sphere& s : scene.Spheres)
+	{
+		file << "sphere " << s.Position.x << " " << s.Position.y << " " << s.Position.z << " " << s.radius << " " << s.MaterialIndex << "\n";
+	}
+
+	file << "# cube <min x y z> <max x y z> <material index>\n";
+	for (const Cube& c : scene.Cubes)
+	{
+		file << "cube " << c.min.x << " " << c.min.y << " " << c.min.z << " "
+			<< c.max.x << " " << c.max.y << " " << c.max.z << " " << c.MaterialIndex << "\n";
+	}
+
+	if (scene.Environment)
+	{
+		file << "# environment <hdr image> <intensity>\n";
+		file << "environment " << scene.Environment->GetPath() << " " << scene.Environment->Intensity << "\n";
+	}
+
+	return (bool)file;
+}
+
+bool SceneLoader::LoadByName(const std::string& name, Scene& scene, std::string& error)
+{
+	if (name == "default")
+		scene = CreateDefaultScene();
+	else if (name == "bounce")
+		scene = CreateBounceHeavyScene();
+	else
+		return LoadFromFile(name, scene, error);
+	return true;
+}
+
+Scene SceneLoader::CreateDefaultScene()
+{
+	Scene scene;
+
+	Material& goldMaterial = scene.Materials.emplace_back();
+	goldMaterial.Albedo = { 0.80f, 0.40f, 0.05f };
+	goldMaterial.roughness = 0.01f;
+	goldMaterial.metallic = 0.7f;
+
+	Material& silver = scene.Materials.emplace_back();
+	silver.Albedo = { 0.98f, 0.98f, 0.98f };
+	silver.roughness = 0.01f;
+	silver.metallic = 0.9f;
+
+	Material& glass = scene.Materials.emplace_back();
+	glass.Albedo = { 0.9f, 0.9f, 0.9f };
+	glass.roughness = 0.0f;
+	glass.metallic = 0.0f;
+	glass.transparency = 0.9f;
+
+	Material& pinkTitanium = scene.Materials.emplace_back();
+	pinkTitanium.Albedo = { 0.999f, 0.0f, 0.98f };
+	pinkTitanium.roughness = 0.0f;
+	pinkTitanium.metallic = 0.999f;
+
+	Material& bluePlastic = scene.Materials.emplace_back();
+	bluePlastic.Albedo = { 0.1f, 0.2f, 0.95f };
+	bluePlastic.roughness = 0.99f;
+	bluePlastic.metallic = 0.0f;
+	bluePlastic.transparency = 0.0f;
+
+	Material& redPlastic = scene.Materials.emplace_back();
+	redPlastic.Albedo = { 0.99f, 0.1f, 0.0f };
+	redPlastic.roughness = 0.90f;
+	redPlastic.metallic = 0.0f;
+	redPlastic.transparency = 0.0f;
+	//-----------------------------------------------------------
+	Material& mirror = scene.Materials.emplace_back();
+	mirror.Albedo = { 0.9f, 0.9f, 0.9f };
+	mirror.roughness = 0.0f;
+	mirror.metallic = 0.999f;
+	mirror.transparency = 0.0f;
+
+	Material& sunMaterial = scene.Materials.emplace_back();
+	sunMaterial.Albedo = { 0.8f, 0.4f, 0.2f };
+	sunMaterial.roughness = 0.01f;
+	sunMaterial.emissionCol = sunMaterial.Albedo;
+	sunMaterial.emissionPow = 6.0f;
+
+	Material& floor = scene.Materials.emplace_back();
+	floor.Albedo = { 0.5f, 0.5f, 0.5f };
+	floor.roughness = 0.1f;
+
+
+	const glm::vec3 positions[] = {
+		glm::vec3(6.0, 0.0, 2.0),
+		glm::vec3(-4.0, 0.0, 4.0),
+		glm::vec3(8.0, 0.0, -6.0),
+		glm::vec3(-3.0, 0.0, -2.0),
+		glm::vec3(8.0, 3.0, 5.0),
+		glm::vec3(5.0, 0.0, -4.0),
+		glm::vec3(3.0, 0.0,-4.0),
+		glm::vec3(6.5, 0.0, 5.0),
+		glm::vec3(16.0, 0.0, 12.0),
+		glm::vec3(-14.0, 0.0, 4.0),
+		glm::vec3(18.0, 0.0, -6.0),
+		glm::vec3(-13.0, 0.0, -2.0),
+		glm::vec3(18.0, 0.0, 5.0),
+		glm::vec3(13.0, 0.0, 9.0)
+	};
+
+	for (size_t i = 0; i < sizeof(positions)/sizeof(positions[0]); i++)
+	{
+		Sphere sphere;
+		sphere.Position = positions[i];
+		sphere.radius = 1.0f;
+		sphere.MaterialIndex = i % 6;
+		//sphere.MaterialIndex = i % scene.Materials.size() - 2; // leave floor and sun material out
+		scene.Spheres.push_back(sphere);
+	}
+	
+	{
+		Sphere sphere;
+		sphere.Position = { 0.0f, 0.0f, 0.0f };
+		sphere.radius = 1.0f;
+		sphere.MaterialIndex = 0; // apply the first material
+		scene.Spheres.push_back(sphere);
+	}
+	{
+		Sphere virtualSun;
+		virtualSun.Position = { -80.0f, 30.0f, -80.0f };
+		virtualSun.radius = 50.0f;
+		virtualSun.MaterialIndex = 7; // apply the sun material
+		scene.Spheres.push_back(virtualSun);
+	}
+
+	{
+		//this is the floor
+		Sphere floor;
+		floor.Position = { 0.0f, -1001.0f, -0.0f };
+		floor.radius = 1000.0f;
+		floor.MaterialIndex = 8;
+		scene.Spheres.push_back(floor);
+	}
+
+	int materials[] = { 2, 6, 3, 4}; // specify which materials to use
+	float sizes[] = { 2.0f, 3.0f , 2.5f, 1.0f}; // specify the sizes
+	for (size_t i = 0; i < 4; i++)
+	{
+		glm::vec3 cubeCenter = glm::vec3{ 10.0f * (float)i, sizes[i]/2.0f - 1.2f, 2.0f - (float)i * (float)i };
+		Cube cube = Cube::FromCenterAndSize(cubeCenter, sizes[i]);
+		cube.MaterialIndex = materials[i];
+		scene.Cubes.push_back(cube);
+	}
+
+	return scene;
+}
+
+// a grid of small mirror spheres in front of the camera on a mirror floor.
+// nearly every ray bounces the maximum number of times, which makes it a good
+// benchmark for the incoherent secondary rays
+Scene SceneLoader::CreateBounceHeavyScene()
+{
+	Scene scene;
+
+	Material& mirror = scene.Materials.emplace_back();
+	mirror.Albedo = { 0.95f, 0.95f, 0.95f };
+	mirror.roughness = 0.0f;
+	mirror.metallic = 1.0f;
+
+	Material& glossy = scene.Materials.emplace_back();
+	glossy.Albedo = { 0.9f, 0.6f, 0.3f };
+	glossy.metallic = 0.8f;
+
+	for (int z = 0; z < 32; z++)
+	{
+		for (int x = 0; x < 32; x++)
+		{
+			Sphere sphere;
+			sphere.Position = { (float)x * 0.6f - 9.3f, 0.0f, -(float)z * 0.6f };
+			sphere.radius = 0.25f;
+			sphere.MaterialIndex = (x + z) % 2;
+			scene.Spheres.push_back(sphere);
+		}
+	}
+
+	Sphere floor;
+	floor.Position = { 0.0f, -1000.3f, 0.0f };
+	floor.radius = 1000.0f;
+	floor.MaterialIndex = 0;
+	scene.Spheres.push_back(floor);
+
+	return scene;
+}
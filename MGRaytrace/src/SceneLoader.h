@@ -0,0 +1,78 @@
+#pragma once
+
+#include "BVH.h"
+#include "Scene.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+
+// a scene loaded in the background, the BVH is already built for it
+struct LoadedScene
+{
+	Scene scene;
+	BVH bvh;
+};
+
+// reads scenes from simple text files. every line is one entry, # starts a comment:
+//
+//   material <name> <albedo r g b> <roughness> <metallic> <transparency> <refractive index> <emission r g b> <emission power>
+//   sphere <position x y z> <radius> <material index>
+//   cube <min x y z> <max x y z> <material index>
+//
+// LoadAsync runs the parsing, the material setup and the BVH build as a background task,
+// so the renderer can keep drawing the old scene until TakeLoadedScene returns the new one
+class SceneLoader
+{
+public:
+	enum class Stage
+	{
+		Idle = 0,
+		Parsing,
+		Materials,
+		Building,
+		Done,
+		Failed
+	};
+
+	SceneLoader() = default;
+	~SceneLoader();
+
+	// returns false if there is already a scene loading
+	bool LoadAsync(const std::string& path, BVH::BuildMethod buildMethod);
+
+	bool IsLoading() const { return m_Task.valid(); }
+	float GetProgress() const { return m_Progress; }
+	Stage GetStage() const { return m_Stage; }
+	const char* GetStageName() const;
+	const std::string& GetError() const { return m_Error; }
+
+	// hands over the loaded scene exactly once, never blocks.
+	// returns nullptr while loading or if loading failed (see GetError)
+	std::unique_ptr<LoadedScene> TakeLoadedScene();
+
+	// parses the file and sanitizes the materials, see Sanitize
+	static bool LoadFromFile(const std::string& path, Scene& scene, std::string& error, std::atomic<float>* progress = nullptr);
+	// adds a default material if there is none and clamps every material index to the existing ones,
+	// the renderer indexes Materials without checking
+	static void Sanitize(Scene& scene);
+	static bool SaveToFile(const std::string& path, const Scene& scene);
+
+	// the scenes which are built into the application
+	static Scene CreateDefaultScene();
+	static Scene CreateBounceHeavyScene();
+
+	// "default" and "bounce" are the built in scenes, every other name is a scene file
+	static bool LoadByName(const std::string& name, Scene& scene, std::string& error);
+private:
+	// only reads the entries, the indices are not checked yet
+	static bool ParseFile(const std::string& path, Scene& scene, std::string& error, std::atomic<float>* progress);
+private:
+	std::future<std::unique_ptr<LoadedScene>> m_Task;
+	std::atomic<float> m_Progress{ 0.0f };
+	std::atomic<Stage> m_Stage{ Stage::Idle };
+
+	std::string m_TaskError; // written by the task, only read after it finished
+	std::string m_Error;
+};
@@ -0,0 +1,292 @@
+#include "Socket.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef WL_PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#include <mutex>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef WL_PLATFORM_WINDOWS
+	using NativeSocket = SOCKET;
+
+	void InitializeSockets()
+	{
+		static std::once_flag initialized;
+		std::call_once(initialized, [] {
+			WSADATA data;
+			WSAStartup(MAKEWORD(2, 2), &data);
+		});
+	}
+
+	void CloseNative(NativeSocket socket) { closesocket(socket); }
+	constexpr int ShutdownBoth = SD_BOTH;
+	constexpr int SendFlags = 0;
+#else
+	using NativeSocket = int;
+
+	void InitializeSockets() {}
+	void CloseNative(NativeSocket socket) { close(socket); }
+	constexpr int ShutdownBoth = SHUT_RDWR;
+
+	// a client which went away must not kill the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+	constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+	constexpr int SendFlags = 0;
+#endif
+#endif
+
+	// splits "tcp:<port>" and "tcp:<host>:<port>", a missing host means localhost
+	bool ParseTcpAddress(const std::string& address, std::string& host, std::string& port)
+	{
+		std::string rest = address.substr(4);
+		size_t colon = rest.rfind(':');
+		host = colon == std::string::npos ? "127.0.0.1" : rest.substr(0, colon);
+		port = colon == std::string::npos ? rest : rest.substr(colon + 1);
+		return !port.empty();
+	}
+
+	// creates the socket for the address and binds or connects it
+	intptr_t Open(const std::string& address, bool listen, std::string& error)
+	{
+		InitializeSockets();
+
+		if (address.rfind("tcp:", 0) == 0)
+		{
+			std::string host, port;
+			if (!ParseTcpAddress(address, host, port))
+			{
+				error = "no port in " + address;
+				return -1;
+			}
+
+			addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			addrinfo* result = nullptr;
+			if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+			{
+				error = "could not resolve " + address;
+				return -1;
+			}
+
+			NativeSocket handle = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+			bool ok = (intptr_t)handle != -1;
+			if (ok && listen)
+			{
+				// a restarted server can take the port again right away
+				int reuse = 1;
+				setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+				ok = bind(handle, result->ai_addr, (int)result->ai_addrlen) == 0 && ::listen(handle, SOMAXCONN) == 0;
+			}
+			else if (ok)
+			{
+				ok = connect(handle, result->ai_addr, (int)result->ai_addrlen) == 0;
+			}
+			freeaddrinfo(result);
+
+			if (!ok)
+			{
+				if ((intptr_t)handle != -1)
+					CloseNative(handle);
+				error = std::string(listen ? "could not listen on " : "could not connect to ") + address;
+				return -1;
+			}
+			return (intptr_t)handle;
+		}
+
+		if (address.rfind("unix:", 0) == 0)
+		{
+#ifdef WL_PLATFORM_WINDOWS
+			error = "unix sockets are not supported on windows, use tcp:<port>";
+			return -1;
+#else
+			std::string path = address.substr(5);
+			sockaddr_un socketAddress = {};
+			socketAddress.sun_family = AF_UNIX;
+			if (path.empty() || path.size() >= sizeof(socketAddress.sun_path))
+			{
+				error = "invalid socket path " + path;
+				return -1;
+			}
+			memcpy(socketAddress.sun_path, path.c_str(), path.size() + 1);
+
+			NativeSocket handle = socket(AF_UNIX, SOCK_STREAM, 0);
+			bool ok = handle != -1;
+			if (ok && listen)
+			{
+				unlink(path.c_str()); // left over from a server which did not shut down cleanly
+				ok = bind(handle, (sockaddr*)&socketAddress, sizeof(socketAddress)) == 0 && ::listen(handle, SOMAXCONN) == 0;
+			}
+			else if (ok)
+			{
+				ok = connect(handle, (sockaddr*)&socketAddress, sizeof(socketAddress)) == 0;
+			}
+
+			if (!ok)
+			{
+				if (handle != -1)
+					CloseNative(handle);
+				error = std::string(listen ? "could not listen on " : "could not connect to ") + address;
+				return -1;
+			}
+			return handle;
+#endif
+		}
+
+		error = "unknown address " + address + ", expected unix:<path> or tcp:<port>";
+		return -1;
+	}
+}
+
+Socket::~Socket()
+{
+	Close();
+}
+
+Socket::Socket(Socket&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		m_Handle = std::exchange(other.m_Handle, InvalidHandle);
+		m_UnixPath = std::move(other.m_UnixPath);
+		m_Buffer = std::move(other.m_Buffer);
+	}
+	return *this;
+}
+
+bool Socket::Listen(const std::string& address, std::string& error)
+{
+	Close();
+	m_Handle = Open(address, true, error);
+	if (IsOpen() && address.rfind("unix:", 0) == 0)
+	{
+		m_UnixPath = address.substr(5);
+	}
+	return IsOpen();
+}
+
+bool Socket::Connect(const std::string& address, std::string& error)
+{
+	Close();
+	m_Handle = Open(address, false, error);
+	return IsOpen();
+}
+
+Socket Socket::Accept()
+{
+	Socket client;
+	if (IsOpen())
+	{
+		NativeSocket handle = accept((NativeSocket)m_Handle, nullptr, nullptr);
+		if ((intptr_t)handle != InvalidHandle)
+		{
+			client.m_Handle = (intptr_t)handle;
+		}
+	}
+	return client;
+}
+
+void Socket::Shutdown()
+{
+	if (IsOpen())
+	{
+		shutdown((NativeSocket)m_Handle, ShutdownBoth);
+	}
+}
+
+void Socket::Close()
+{
+	if (IsOpen())
+	{
+		CloseNative((NativeSocket)m_Handle);
+#ifndef WL_PLATFORM_WINDOWS
+		if (!m_UnixPath.empty())
+			unlink(m_UnixPath.c_str());
+#endif
+	}
+	m_Handle = InvalidHandle;
+	m_UnixPath.clear();
+	m_Buffer.clear();
+}
+
+bool Socket::Send(const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		// send can take less than everything, the rest goes with the next call
+		int sent = (int)send((NativeSocket)m_Handle, bytes, (int)std::min<size_t>(size, 1 << 30), SendFlags);
+		if (sent <= 0)
+			return false;
+
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+bool Socket::SendLine(const std::string& line)
+{
+	std::string message = line + "\n";
+	return Send(message.data(), message.size());
+}
+
+bool Socket::FillBuffer()
+{
+	char chunk[64 * 1024];
+	int received = (int)recv((NativeSocket)m_Handle, chunk, sizeof(chunk), 0);
+	if (received <= 0)
+		return false;
+
+	m_Buffer.append(chunk, received);
+	return true;
+}
+
+bool Socket::ReceiveLine(std::string& line)
+{
+	size_t end;
+	while ((end = m_Buffer.find('\n')) == std::string::npos)
+	{
+		if (!FillBuffer())
+			return false;
+	}
+
+	line = m_Buffer.substr(0, end);
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	m_Buffer.erase(0, end + 1);
+	return true;
+}
+
+bool Socket::Receive(void* data, size_t size)
+{
+	while (m_Buffer.size() < size)
+	{
+		if (!FillBuffer())
+			return false;
+	}
+
+	memcpy(data, m_Buffer.data(), size);
+	m_Buffer.erase(0, size);
+	return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// a blocking stream socket, either a unix domain socket or a tcp connection.
+// addresses are written as "unix:<path>" or "tcp:<port>" / "tcp:<host>:<port>",
+// a tcp socket without a host only listens on (or connects to) localhost
+class Socket
+{
+public:
+	Socket() = default;
+	~Socket();
+
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+	Socket(Socket&& other) noexcept;
+	Socket& operator=(Socket&& other) noexcept;
+
+	bool Listen(const std::string& address, std::string& error);
+	bool Connect(const std::string& address, std::string& error);
+
+	// blocks until a client connects, the returned socket is closed if listening stopped
+	Socket Accept();
+
+	// wakes up Accept and Receive calls blocked in other threads, they fail afterwards
+	void Shutdown();
+	void Close();
+	bool IsOpen() const { return m_Handle != InvalidHandle; }
+
+	bool Send(const void* data, size_t size);
+	bool SendLine(const std::string& line);
+
+	// read exactly one line (without the line break) or exactly size bytes
+	bool ReceiveLine(std::string& line);
+	bool Receive(void* data, size_t size);
+private:
+	bool FillBuffer();
+private:
+	static constexpr intptr_t InvalidHandle = -1; // the same value as INVALID_SOCKET on windows
+
+	intptr_t m_Handle = InvalidHandle;
+	std::string m_UnixPath;	// a listening unix socket removes its file again when closed
+	std::string m_Buffer;	// received bytes which were not read yet
+};
@@ -0,0 +1,164 @@
+#include "TileBins.h"
+
+#include <algorithm>
+#include <cstring>
+#include <execution>
+#include <limits>
+
+void TileBins::Build(const Scene& scene, const PrimitiveTable& primitives, const Camera& camera, uint32_t width, uint32_t height)
+{
+	m_Width = width;
+	m_Height = height;
+	m_TilesX = (width + TileSize - 1) >> TileShift;
+	m_TilesY = (height + TileSize - 1) >> TileShift;
+	m_View = camera.GetView();
+	m_Projection = camera.GetProjection();
+
+	glm::mat4 viewProjection = m_Projection * m_View;
+	glm::vec3 eye = camera.GetPosition();
+
+	// how far from the camera a point just in front of it can be and still be seen, per unit of depth
+	// (the ray through the corner of the screen). boxes closer than that to the camera get every tile
+	float cornerDistance = glm::sqrt(1.0f + 1.0f / (m_Projection[0][0] * m_Projection[0][0]) + 1.0f / (m_Projection[1][1] * m_Projection[1][1]));
+	float nearMargin = 2.0f * ClipDepth * cornerDistance;
+
+	// the projection of every primitive is independent, the lists are filled afterwards in table order
+	const std::vector<uint32_t>& ids = primitives.ids;
+	m_Rects.resize(ids.size());
+	std::for_each(std::execution::par, ids.begin(), ids.end(),
+		[&](const uint32_t& id) {
+			size_t i = &id - ids.data();
+			uint32_t index = PrimitiveId::Index(id);
+			if (PrimitiveId::Type(id) == PrimitiveType::Sphere)
+			{
+				const Sphere& sphere = scene.Spheres[index];
+				m_Rects[i] = ProjectBounds(sphere.Position - glm::vec3(sphere.radius), sphere.Position + glm::vec3(sphere.radius), viewProjection, eye, nearMargin);
+			}
+			else
+			{
+				const Cube& cube = scene.Cubes[index];
+				m_Rects[i] = ProjectBounds(cube.min, cube.max, viewProjection, eye, nearMargin);
+			}
+		});
+
+	// count the primitives of every tile, the prefix sum turns the counts into offsets
+	uint32_t tileCount = m_TilesX * m_TilesY;
+	m_Offsets.assign(tileCount + 1, 0);
+	for (const TileRect& rect : m_Rects)
+	{
+		for (uint32_t ty = rect.minY; ty <= rect.maxY && rect.minX <= rect.maxX; ty++)
+		{
+			for (uint32_t tx = rect.minX; tx <= rect.maxX; tx++)
+				m_Offsets[tx + ty * m_TilesX + 1]++;
+		}
+	}
+	for (uint32_t tile = 0; tile < tileCount; tile++)
+	{
+		m_Offsets[tile + 1] += m_Offsets[tile];
+	}
+
+	m_Ids.resize(m_Offsets[tileCount]);
+	std::vector<uint32_t> fill(m_Offsets.begin(), m_Offsets.end() - 1);
+	for (size_t i = 0; i < m_Rects.size(); i++)
+	{
+		const TileRect& rect = m_Rects[i];
+		for (uint32_t ty = rect.minY; ty <= rect.maxY && rect.minX <= rect.maxX; ty++)
+		{
+			for (uint32_t tx = rect.minX; tx <= rect.maxX; tx++)
+				m_Ids[fill[tx + ty * m_TilesX]++] = ids[i];
+		}
+	}
+}
+
+bool TileBins::Matches(const Camera& camera, uint32_t width, uint32_t height) const
+{
+	return width == m_Width && height == m_Height
+		&& memcmp(&camera.GetView(), &m_View, sizeof(glm::mat4)) == 0
+		&& memcmp(&camera.GetProjection(), &m_Projection, sizeof(glm::mat4)) == 0;
+}
+
+void TileBins::Release()
+{
+	std::vector<uint32_t>().swap(m_Offsets);
+	std::vector<uint32_t>().swap(m_Ids);
+	std::vector<TileRect>().swap(m_Rects);
+	m_Width = 0;
+	m_Height = 0;
+	m_TilesX = 0;
+	m_TilesY = 0;
+}
+
+float TileBins::GetAverageBinSize() const
+{
+	uint32_t tileCount = m_TilesX * m_TilesY;
+	return tileCount > 0 ? (float)m_Ids.size() / (float)tileCount : 0.0f;
+}
+
+TileBins::TileRect TileBins::ProjectBounds(const glm::vec3& min, const glm::vec3& max, const glm::mat4& viewProjection,
+	const glm::vec3& eye, float nearMargin) const
+{
+	// a box around the camera (or nearly touching it) can be seen in every direction
+	if (glm::distance(eye, glm::clamp(eye, min, max)) <= nearMargin)
+		return { 0, 0, m_TilesX - 1, m_TilesY - 1 };
+
+	glm::vec4 clip[8];
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 point((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+		clip[corner] = viewProjection * glm::vec4(point, 1.0f);
+	}
+
+	// the part of the box in front of the camera projects into the hull of its corners in front and the points where
+	// the edges cross the plane at ClipDepth. the rays start at the camera and not at the near clip plane of the camera,
+	// so the plane has to be this close, the part between it and the camera is covered by the test above
+	glm::vec2 ndcMin(std::numeric_limits<float>::max());
+	glm::vec2 ndcMax(-std::numeric_limits<float>::max());
+	bool visible = false;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const glm::vec4& a = clip[corner];
+		if (a.w >= ClipDepth)
+		{
+			glm::vec2 ndc = glm::vec2(a) / a.w;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+			visible = true;
+		}
+
+		// the three edges going to the corners with one more coordinate at max
+		for (int axis = 1; axis < 8; axis <<= 1)
+		{
+			if (corner & axis)
+				continue;
+			const glm::vec4& b = clip[corner | axis];
+			if ((a.w < ClipDepth) == (b.w < ClipDepth))
+				continue;
+
+			glm::vec4 crossing = glm::mix(a, b, (ClipDepth - a.w) / (b.w - a.w));
+			glm::vec2 ndc = glm::vec2(crossing) / ClipDepth;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+		}
+	}
+
+	// completely behind the camera
+	TileRect empty = { 1, 1, 0, 0 };
+	if (!visible)
+		return empty;
+
+	// the ray of pixel x goes through x / width * 2 - 1 (see Camera::RecalculateRayDirections),
+	// two pixels of margin on each side: one for the rays jittered by the pixel filter
+	// (Settings::SamplesPerFrame) and one for the rounding of the projection
+	glm::vec2 size((float)m_Width, (float)m_Height);
+	glm::vec2 pixelMin = glm::floor((ndcMin + 1.0f) * 0.5f * size) - 2.0f;
+	glm::vec2 pixelMax = glm::ceil((ndcMax + 1.0f) * 0.5f * size) + 2.0f;
+
+	if (pixelMax.x < 0.0f || pixelMax.y < 0.0f || pixelMin.x >= size.x || pixelMin.y >= size.y)
+		return empty;
+
+	pixelMin = glm::max(pixelMin, glm::vec2(0.0f));
+	pixelMax = glm::min(pixelMax, size - 1.0f);
+
+	return { (uint32_t)pixelMin.x >> TileShift, (uint32_t)pixelMin.y >> TileShift,
+		(uint32_t)pixelMax.x >> TileShift, (uint32_t)pixelMax.y >> TileShift };
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Camera.h"
+#include "Primitive.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// sorts the primitives into screen tiles for the primary rays.
+// the bounding box of every primitive is projected with the view and projection of the camera,
+// a tile lists all primitives whose projection overlaps it. all primary rays start at the camera,
+// so a ray through a pixel can only hit what is listed in the tile of the pixel.
+//
+// the lists are conservative: the projected box is grown by the radius of the pixel filter and a
+// pixel against rounding, a box reaching behind the camera is clipped just in front of it and only
+// a box around the camera is put into every tile. the ids keep
+// the order of the primitive table, so the closest hit of a list is the same one the brute force loop finds
+class TileBins
+{
+public:
+	static constexpr uint32_t TileShift = 4;
+	static constexpr uint32_t TileSize = 1u << TileShift; // 16x16 pixels
+
+	struct Bin
+	{
+		const uint32_t* ids;
+		uint32_t count;
+	};
+
+	void Build(const Scene& scene, const PrimitiveTable& primitives, const Camera& camera, uint32_t width, uint32_t height);
+
+	// true if the bins were built for exactly this camera and size
+	bool Matches(const Camera& camera, uint32_t width, uint32_t height) const;
+
+	Bin GetBin(uint32_t x, uint32_t y) const
+	{
+		uint32_t tile = (x >> TileShift) + (y >> TileShift) * m_TilesX;
+		return { m_Ids.data() + m_Offsets[tile], m_Offsets[tile + 1] - m_Offsets[tile] };
+	}
+
+	uint32_t GetTilesX() const { return m_TilesX; }
+	uint32_t GetTilesY() const { return m_TilesY; }
+
+	// average length of the lists, shown next to the number of primitives in the scene
+	float GetAverageBinSize() const;
+
+	size_t GetMemorySize() const { return (m_Offsets.capacity() + m_Ids.capacity()) * sizeof(uint32_t) + m_Rects.capacity() * sizeof(TileRect); }
+	// frees all lists, Matches is false until the next Build
+	void Release();
+private:
+	// inclusive tile rectangle of one primitive, empty if minX > maxX
+	struct TileRect
+	{
+		uint32_t minX, minY, maxX, maxY;
+	};
+
+	// depth (clip w) of the plane boxes reaching behind the camera are clipped at
+	static constexpr float ClipDepth = 1e-4f;
+
+	TileRect ProjectBounds(const glm::vec3& min, const glm::vec3& max, const glm::mat4& viewProjection,
+		const glm::vec3& eye, float nearMargin) const;
+private:
+	uint32_t m_Width = 0;
+	uint32_t m_Height = 0;
+	uint32_t m_TilesX = 0;
+	uint32_t m_TilesY = 0;
+
+	glm::mat4 m_View{ 0.0f };
+	glm::mat4 m_Projection{ 0.0f };
+
+	// the list of a tile is m_Ids[m_Offsets[tile]] .. m_Ids[m_Offsets[tile + 1]]
+	std::vector<uint32_t> m_Offsets;
+	std::vector<uint32_t> m_Ids;
+
+	std::vector<TileRect> m_Rects; // kept to avoid the allocation on every rebuild
+};
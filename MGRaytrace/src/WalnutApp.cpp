@@ -8,6 +8,9 @@
 
 #include "Renderer.h"
 #include "Camera.h"
+#include "CommandLine.h"
+#include "EnvironmentMap.h"
+#include "SceneLoader.h"
 
 
 using namespace Walnut;
@@ -18,134 +21,61 @@ public:
 	RaytraceScene()
 		: m_Camera(45.0f, 0.1f, 100.0f)
 	{
+		m_Scene = SceneLoader::CreateDefaultScene();
+	}
 
-		Material& goldMaterial = m_Scene.Materials.emplace_back();
-		goldMaterial.Albedo = { 0.80f, 0.40f, 0.05f };
-		goldMaterial.roughness = 0.01f;
-		goldMaterial.metallic = 0.7f;
-
-		Material& silver = m_Scene.Materials.emplace_back();
-		silver.Albedo = { 0.98f, 0.98f, 0.98f };
-		silver.roughness = 0.01f;
-		silver.metallic = 0.9f;
-
-		Material& glass = m_Scene.Materials.emplace_back();
-		glass.Albedo = { 0.9f, 0.9f, 0.9f };
-		glass.roughness = 0.0f;
-		glass.metallic = 0.0f;
-		glass.transparency = 0.9f;
-
-		Material& pinkTitanium = m_Scene.Materials.emplace_back();
-		pinkTitanium.Albedo = { 0.999f, 0.0f, 0.98f };
-		pinkTitanium.roughness = 0.0f;
-		pinkTitanium.metallic = 0.999f;
-
-		Material& bluePlastic = m_Scene.Materials.emplace_back();
-		bluePlastic.Albedo = { 0.1f, 0.2f, 0.95f };
-		bluePlastic.roughness = 0.99f;
-		bluePlastic.metallic = 0.0f;
-		bluePlastic.transparency = 0.0f;
-
-		Material& redPlastic = m_Scene.Materials.emplace_back();
-		redPlastic.Albedo = { 0.99f, 0.1f, 0.0f };
-		redPlastic.roughness = 0.90f;
-		redPlastic.metallic = 0.0f;
-		redPlastic.transparency = 0.0f;
-		//-----------------------------------------------------------
-		Material& mirror = m_Scene.Materials.emplace_back();
-		mirror.Albedo = { 0.9f, 0.9f, 0.9f };
-		mirror.roughness = 0.0f;
-		mirror.metallic = 0.999f;
-		mirror.transparency = 0.0f;
-
-		Material& sunMaterial = m_Scene.Materials.emplace_back();
-		sunMaterial.Albedo = { 0.8f, 0.4f, 0.2f };
-		sunMaterial.roughness = 0.01f;
-		sunMaterial.emissionCol = sunMaterial.Albedo;
-		sunMaterial.emissionPow = 6.0f;
-
-		Material& floor = m_Scene.Materials.emplace_back();
-		floor.Albedo = { 0.5f, 0.5f, 0.5f };
-		floor.roughness = 0.1f;
-
-
-		const glm::vec3 positions[] = {
-			glm::vec3(6.0, 0.0, 2.0),
-			glm::vec3(-4.0, 0.0, 4.0),
-			glm::vec3(8.0, 0.0, -6.0),
-			glm::vec3(-3.0, 0.0, -2.0),
-			glm::vec3(8.0, 3.0, 5.0),
-			glm::vec3(5.0, 0.0, -4.0),
-			glm::vec3(3.0, 0.0,-4.0),
-			glm::vec3(6.5, 0.0, 5.0),
-			glm::vec3(16.0, 0.0, 12.0),
-			glm::vec3(-14.0, 0.0, 4.0),
-			glm::vec3(18.0, 0.0, -6.0),
-			glm::vec3(-13.0, 0.0, -2.0),
-			glm::vec3(18.0, 0.0, 5.0),
-			glm::vec3(13.0, 0.0, 9.0)
-		};
 
-		for (size_t i = 0; i < sizeof(positions)/sizeof(positions[0]); i++)
-		{
-			Sphere sphere;
-			sphere.Position = positions[i];
-			sphere.radius = 1.0f;
-			sphere.MaterialIndex = i % 6;
-			//sphere.MaterialIndex = i % m_Scene.Materials.size() - 2; // leave floor and sun material out
-			m_Scene.Spheres.push_back(sphere);
-		}
-		
+	virtual void OnUpdate(float ts) override // ts is a timestep of the time passed from the last call of the func to the current call
+	{
+		if (m_Camera.OnUpdate(ts))
 		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, 0.0f, 0.0f };
-			sphere.radius = 1.0f;
-			sphere.MaterialIndex = 0; // apply the first material
-			m_Scene.Spheres.push_back(sphere);
+			m_Renderer.FrameCountReset();
 		}
+
+		if (m_AnimateScene)
 		{
-			Sphere virtualSun;
-			virtualSun.Position = { -80.0f, 30.0f, -80.0f };
-			virtualSun.radius = 50.0f;
-			virtualSun.MaterialIndex = 7; // apply the sun material
-			m_Scene.Spheres.push_back(virtualSun);
+			AnimateScene(ts);
+			OnSceneEdited();
 		}
+	}
+
+	// lets the small spheres bob up and down and the cubes slide sideways,
+	// the sun and the floor are far too big to be moved around
+	void AnimateScene(float ts)
+	{
+		float previousTime = m_AnimationTime;
+		m_AnimationTime += ts;
 
+		for (size_t i = 0; i < m_Scene.Spheres.size(); i++)
 		{
-			//this is the floor
-			Sphere floor;
-			floor.Position = { 0.0f, -1001.0f, -0.0f };
-			floor.radius = 1000.0f;
-			floor.MaterialIndex = 8;
-			m_Scene.Spheres.push_back(floor);
+			Sphere& sphere = m_Scene.Spheres[i];
+			if (sphere.radius < 10.0f)
+			{
+				sphere.Position.y += 0.5f * (glm::sin(m_AnimationTime + (float)i) - glm::sin(previousTime + (float)i));
+			}
 		}
-
-		int materials[] = { 2, 6, 3, 4}; // specify which materials to use
-		float sizes[] = { 2.0f, 3.0f , 2.5f, 1.0f}; // specify the sizes
-		for (size_t i = 0; i < 4; i++)
+		for (size_t i = 0; i < m_Scene.Cubes.size(); i++)
 		{
-			glm::vec3 cubeCenter = glm::vec3{ 10.0f * (float)i, sizes[i]/2.0f - 1.2f, 2.0f - (float)i * (float)i };
-			Cube cube = Cube::FromCenterAndSize(cubeCenter, sizes[i]);
-			cube.MaterialIndex = materials[i];
-			m_Scene.Cubes.push_back(cube);
+			float offset = glm::sin(0.5f * m_AnimationTime + (float)i) - glm::sin(0.5f * previousTime + (float)i);
+			m_Scene.Cubes[i].min.x += offset;
+			m_Scene.Cubes[i].max.x += offset;
 		}
-		
-		
 	}
 
-
-	virtual void OnUpdate(float ts) override // ts is a timestep of the time passed from the last call of the func to the current call
+	// geometry changed, the BVH has to follow and the old samples are no longer valid
+	void OnSceneEdited()
 	{
-		if (m_Camera.OnUpdate(ts))
-		{
-			m_Renderer.FrameCountReset();
-		}
+		m_Renderer.OnSceneChanged();
+		m_Renderer.FrameCountReset();
 	}
 
 	virtual void OnUIRender() override //this func gets called every frame
 	{
 		ImGui::Begin("Settings");
 		ImGui::Text("FPS: %.0f \nt_Frame: %.3fms", (float)(1000.0f / m_LastRenderTime), m_LastRenderTime);
+		const char* buildKinds[] = { "", " (refit)", " (rebuild)" };
+		ImGui::Text("t_Build: %.3fms%s \nt_Trace: %.3fms", m_Renderer.GetLastBuildTime(),
+			buildKinds[(int)m_Renderer.GetLastBuildKind()], m_Renderer.GetLastTraceTime());
 		if (ImGui::Button("Reset rendering"))
 		{
 			m_Renderer.FrameCountReset();
@@ -153,19 +83,183 @@ public:
 		ImGui::Checkbox("Ambient Occlusion", &m_Renderer.GetSettings().ambientOcclusion);
 		ImGui::Checkbox("Accumulate Samples", &m_Renderer.GetSettings().Accumulate);
 		ImGui::Checkbox("Multithreading", &m_Renderer.GetSettings().Multithreading);
+		ImGui::Checkbox("Specialised shading", &m_Renderer.GetSettings().SpecialisedShading);
+		int samplesPerFrame = (int)m_Renderer.GetSettings().SamplesPerFrame;
+		if (ImGui::DragInt("Samples per frame", &samplesPerFrame, 0.1f, 1, 64))
+		{
+			// frames with different sample counts would be averaged with the same weight
+			m_Renderer.GetSettings().SamplesPerFrame = (uint32_t)samplesPerFrame;
+			m_Renderer.FrameCountReset();
+		}
+		ImGui::Combo("Acceleration", (int*)&m_Renderer.GetSettings().acceleration, "Brute force\0Binary BVH\0Wide BVH (4 children, SSE)\0");
+		ImGui::Combo("BVH build", (int*)&m_Renderer.GetSettings().buildMethod, "SAH (binned)\0Morton (LBVH)\0");
+		ImGui::DragFloat("Rebuild threshold", &m_Renderer.GetSettings().RebuildThreshold, 0.05f, 1.0f, 10.0f);
+		ImGui::Checkbox("Tile binning (primary rays)", &m_Renderer.GetSettings().TileBinning);
+		ImGui::Text("t_Binning: %.3fms, %.1f primitives per tile of %u", m_Renderer.GetLastBinningTime(),
+			m_Renderer.GetAverageBinSize(), (uint32_t)(m_Scene.Spheres.size() + m_Scene.Cubes.size()));
+
+		ImGui::Checkbox("Priority tiles", &m_Renderer.GetSettings().PriorityTiles);
+		ImGui::DragFloat("Priority budget (ms)", &m_Renderer.GetSettings().PriorityBudgetMs, 1.0f, 1.0f, 1000.0f);
+		ImGui::DragFloat("Priority falloff", &m_Renderer.GetSettings().PriorityFalloff, 0.05f, 0.0f, 10.0f);
+		ImGui::DragInt("Focus sphere", &m_FocusSphere, 1.0f, -1, (int)m_Scene.Spheres.size() - 1);
+		ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "-1 follows the mouse, left drag in the viewport crops the rendering");
+		if (m_Renderer.HasRegionOfInterest() && ImGui::Button("Clear crop"))
+		{
+			m_Renderer.SetRegionOfInterest(0, 0, 0, 0);
+		}
+		if (ImGui::Checkbox("Only re-render the edited material", &m_RenderEditedMaterialOnly) && !m_RenderEditedMaterialOnly)
+		{
+			m_Renderer.SetFocusMaterial(-1);
+		}
+
+		const NumaTopology& topology = NumaTopology::Get();
+		ImGui::Checkbox("Pin threads to NUMA nodes", &m_Renderer.GetSettings().NumaPinning);
+		ImGui::Text("NUMA nodes: %u, CPUs: %u", (uint32_t)topology.nodes.size(), topology.GetCpuCount());
+		for (const NumaThreadPool::NodeStatistics& node : m_Renderer.GetNodeStatistics())
+		{
+			// pixels per second of the node, the rows are split by the number of threads
+			float megapixels = node.milliseconds > 0.0f ? (float)node.rows * m_ViewportWidth / (node.milliseconds * 1000.0f) : 0.0f;
+			ImGui::Text("  node %u: %u threads, %u rows, %.2f ms, %.1f Mpixel/s", node.node, node.threads, node.rows, node.milliseconds, megapixels);
+		}
+
+		ImGui::Separator();
+		int memoryBudget = (int)m_Renderer.GetSettings().MemoryBudgetMB;
+		if (ImGui::DragInt("Memory budget (MB, 0 = none)", &memoryBudget, 1.0f, 0, 1 << 20))
+		{
+			m_Renderer.GetSettings().MemoryBudgetMB = (uint32_t)memoryBudget;
+		}
+		const Renderer::MemoryUsage& memory = m_Renderer.GetMemoryUsage();
+		ImGui::Text("Memory: %.1f MB", memory.Total() / 1048576.0f);
+		ImGui::Text("  framebuffers %.1f MB, ray cache %.1f MB", memory.framebuffers / 1048576.0f, memory.rayCache / 1048576.0f);
+		ImGui::Text("  scene %.1f MB, acceleration %.1f MB, scheduling %.2f MB", memory.scene / 1048576.0f,
+			memory.acceleration / 1048576.0f, memory.scheduling / 1048576.0f);
+		if (memory.tileBinsDropped || memory.rayCacheDropped || memory.wideBVHDropped)
+		{
+			ImGui::TextColored(ImVec4(0.9f, 0.6f, 0.3f, 1.0f), "  dropped:%s%s%s", memory.tileBinsDropped ? " tile bins" : "",
+				memory.rayCacheDropped ? " ray cache" : "", memory.wideBVHDropped ? " wide BVH" : "");
+		}
+		if (memory.overBudget)
+		{
+			ImGui::TextColored(ImVec4(0.9f, 0.3f, 0.3f, 1.0f), "  over the budget without any cache");
+		}
+
+		ImGui::Separator();
+		ImGui::InputText("Scene file", m_SceneFile, sizeof(m_SceneFile));
+		if (m_SceneLoader.IsLoading())
+		{
+			// the old scene keeps rendering until the new one is completely ready
+			ImGui::ProgressBar(m_SceneLoader.GetProgress(), ImVec2(-1.0f, 0.0f), m_SceneLoader.GetStageName());
+		}
+		else
+		{
+			if (ImGui::Button("Load"))
+			{
+				m_SceneLoader.LoadAsync(m_SceneFile, m_Renderer.GetSettings().buildMethod);
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Save"))
+			{
+				SceneLoader::SaveToFile(m_SceneFile, m_Scene);
+			}
+		}
+		if (!m_SceneLoader.GetError().empty())
+		{
+			ImGui::TextColored(ImVec4(0.9f, 0.3f, 0.3f, 1.0f), "%s", m_SceneLoader.GetError().c_str());
+		}
+
+		ImGui::Separator();
+		ImGui::InputText("Environment", m_EnvironmentFile, sizeof(m_EnvironmentFile));
+		if (ImGui::Button("Load##Environment"))
+		{
+			auto environment = std::make_shared<EnvironmentMap>();
+			m_EnvironmentError.clear();
+			if (environment->Load(m_EnvironmentFile, m_EnvironmentError))
+			{
+				m_Scene.Environment = environment;
+				m_Renderer.FrameCountReset();
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Clear##Environment"))
+		{
+			m_Scene.Environment.reset();
+			m_Renderer.FrameCountReset();
+		}
+		if (m_Scene.Environment && ImGui::DragFloat("Environment intensity", &m_Scene.Environment->Intensity, 0.01f, 0.0f, 100.0f))
+		{
+			m_Renderer.FrameCountReset();
+		}
+		if (!m_EnvironmentError.empty())
+		{
+			ImGui::TextColored(ImVec4(0.9f, 0.3f, 0.3f, 1.0f), "%s", m_EnvironmentError.c_str());
+		}
+
+		ImGui::Separator();
+		ImGui::InputText("Checkpoint file", m_CheckpointFile, sizeof(m_CheckpointFile));
+		ImGui::DragFloat("Flush every (s)", &m_CheckpointInterval, 1.0f, 1.0f, 3600.0f);
+		ImGui::Checkbox("Overwrite other files", &m_CheckpointOverwrite);
+		bool checkpointing = m_Renderer.IsCheckpointing();
+		if (ImGui::Checkbox("Checkpoint", &checkpointing))
+		{
+			if (checkpointing)
+				m_Renderer.EnableCheckpoint(m_CheckpointFile, m_CheckpointInterval, m_CheckpointOverwrite);
+			else
+				m_Renderer.DisableCheckpoint();
+		}
+		if (!m_Renderer.GetCheckpointNotice().empty())
+		{
+			ImGui::TextColored(ImVec4(0.9f, 0.3f, 0.3f, 1.0f), "%s", m_Renderer.GetCheckpointNotice().c_str());
+		}
+		ImGui::Text("Accumulated frames: %u", m_Renderer.GetAccumulatedFrames());
+
+		ImGui::Separator();
+		if (ImGui::Button("Benchmark shading"))
+		{
+			m_ShadingBenchmark = m_Renderer.BenchmarkShading(m_Scene);
+		}
+		for (const Renderer::ShadingBenchmark& result : m_ShadingBenchmark)
+		{
+			ImGui::Text("Material %d (%s): %.1fns -> %.1fns", result.materialIndex, MaterialTypeName(result.type),
+				result.genericNs, result.specialisedNs);
+		}
+
+		ImGui::Separator();
+		if (ImGui::Button("Benchmark acceleration"))
+		{
+			// once on the default scene and once on a scene full of mirrors where most rays bounce 5 times
+			static const Scene bounceHeavy = SceneLoader::CreateBounceHeavyScene();
+			m_AccelerationBenchmark = m_Renderer.BenchmarkAcceleration(m_Scene, m_Camera);
+			m_BounceHeavyBenchmark = m_Renderer.BenchmarkAcceleration(bounceHeavy, m_Camera);
+		}
+		const char* accelerationNames[] = { "Brute force", "Binary BVH", "Wide BVH" };
+		for (const Renderer::AccelerationBenchmark& result : m_AccelerationBenchmark)
+		{
+			ImGui::Text("Default %s: build %.2fms, t_Frame %.3fms", accelerationNames[(int)result.acceleration], result.buildMs, result.frameMs);
+		}
+		for (const Renderer::AccelerationBenchmark& result : m_BounceHeavyBenchmark)
+		{
+			ImGui::Text("Mirrors %s: build %.2fms, t_Frame %.3fms", accelerationNames[(int)result.acceleration], result.buildMs, result.frameMs);
+		}
 		ImGui::End();
 
 		ImGui::Begin("Scene");
-		/*ImGui::Text("Cubes");
+		ImGui::Checkbox("Animate", &m_AnimateScene);
+		ImGui::Text("Cubes");
 		for (size_t i = 0; i < m_Scene.Cubes.size(); ++i)
 		{
-			ImGui::PushID(i);
-			
+			ImGui::PushID((int)i);
+
+			// the cube is dragged by its center, min and max are moved along with it
 			Cube& cube = m_Scene.Cubes[i];
-			ImGui::DragFloat3("Pos", glm::value_ptr(cube.center), 0.1f);
-			//ImGui::DragFloat("Rad", &sphere.radius, 0.1f);
-			//ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1);
-			
+			glm::vec3 center = (cube.min + cube.max) * 0.5f;
+			if (ImGui::DragFloat3("Pos", glm::value_ptr(center), 0.1f))
+			{
+				glm::vec3 offset = center - (cube.min + cube.max) * 0.5f;
+				cube.min += offset;
+				cube.max += offset;
+				OnSceneEdited();
+			}
+
 			ImGui::Separator();
 
 			ImGui::PopID();
@@ -173,37 +267,53 @@ public:
 		ImGui::Text("Spheres");
 		for (size_t i = 0; i < m_Scene.Spheres.size(); ++i)
 		{
-			ImGui::PushID(i);
+			ImGui::PushID((int)(m_Scene.Cubes.size() + i));
 
 			Sphere& sphere = m_Scene.Spheres[i];
-			ImGui::DragFloat3("Pos", glm::value_ptr(sphere.Position), 0.1f);
-			ImGui::DragFloat("Rad", &sphere.radius, 0.1f);
-			ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1);
+			bool edited = ImGui::DragFloat3("Pos", glm::value_ptr(sphere.Position), 0.1f);
+			edited |= ImGui::DragFloat("Rad", &sphere.radius, 0.1f, 0.01f, 2000.0f);
+			if (edited)
+			{
+				OnSceneEdited();
+			}
+			if (ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1))
+			{
+				m_Renderer.FrameCountReset();
+			}
 
 			ImGui::Separator();
 
 			ImGui::PopID();
-		}*/
-		ImGui::Separator();
-		ImGui::TextColored(ImVec4(1.0f, 1.0f, 1.0f, 1.0f), "Artificial Sun");
-		ImGui::DragFloat("Emission power", &m_Scene.Materials[7].emissionPow, 0.05f, 0.0f, 60.0f);
-		ImGui::ColorEdit3("Emission color", glm::value_ptr(m_Scene.Materials[7].emissionCol));
+		}
 		ImGui::Separator();
+		if (m_Scene.Materials.size() > 7) // loaded scenes might not have the sun material
+		{
+			ImGui::TextColored(ImVec4(1.0f, 1.0f, 1.0f, 1.0f), "Artificial Sun");
+			ImGui::DragFloat("Emission power", &m_Scene.Materials[7].emissionPow, 0.05f, 0.0f, 60.0f);
+			ImGui::ColorEdit3("Emission color", glm::value_ptr(m_Scene.Materials[7].emissionCol));
+			ImGui::Separator();
+		}
 
 		ImGui::Text("Materials");
-		for (size_t i = 0; i < m_Scene.Materials.size() - 2; ++i)
+		for (size_t i = 0; i + 2 < m_Scene.Materials.size(); ++i)
 		{
 			ImGui::PushID(i);
 
 			Material& material = m_Scene.Materials[i];
 
-			ImGui::ColorEdit3("Albedo", glm::value_ptr(material.Albedo));
-			ImGui::DragFloat("Roughness", &material.roughness, 0.05f, 0.0f, 1.0f);
-			ImGui::DragFloat("Metallic", &material.metallic, 0.05f, 0.0f, 1.0f);
-			ImGui::DragFloat("Transparency", &material.transparency, 0.05f, 0.0f, 1.0f);
+			bool edited = ImGui::ColorEdit3("Albedo", glm::value_ptr(material.Albedo));
+			edited |= ImGui::DragFloat("Roughness", &material.roughness, 0.05f, 0.0f, 1.0f);
+			edited |= ImGui::DragFloat("Metallic", &material.metallic, 0.05f, 0.0f, 1.0f);
+			edited |= ImGui::DragFloat("Transparency", &material.transparency, 0.05f, 0.0f, 1.0f);
 			ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "Transparency uses more CPU!");
-			ImGui::ColorEdit3("Emission col", glm::value_ptr(material.emissionCol));
-			ImGui::DragFloat("Emission pow", &material.emissionPow, 0.05f, 0.0f, std::numeric_limits<float>::max());
+			edited |= ImGui::ColorEdit3("Emission col", glm::value_ptr(material.emissionCol));
+			edited |= ImGui::DragFloat("Emission pow", &material.emissionPow, 0.05f, 0.0f, std::numeric_limits<float>::max());
+
+			// only the tiles showing this material start over, the rest of the image keeps its samples
+			if (edited && m_RenderEditedMaterialOnly)
+			{
+				m_Renderer.ResetMaterialTiles((int)i);
+			}
 
 			ImGui::Separator();
 
@@ -221,11 +331,17 @@ public:
 		auto image = m_Renderer.GetFinalImage();
 		if (image) {
 			//check if there is even a image, otherwise it will crash as it tries to render at nullptr
+			ImVec2 imageOrigin = ImGui::GetCursorScreenPos();
 			ImGui::Image
 			(
 				//the last two ImVec2's just reverse the way the image is being displayed
 				image->GetDescriptorSet(), { (float)image->GetWidth(), (float)image->GetHeight() }, ImVec2(0, 1), ImVec2(1, 0)
 			);
+
+			// an invisible button on top catches the mouse, so dragging does not move the window
+			ImGui::SetCursorScreenPos(imageOrigin);
+			ImGui::InvisibleButton("##Viewport", { (float)image->GetWidth(), (float)image->GetHeight() });
+			UpdateViewportInput(imageOrigin, image->GetWidth(), image->GetHeight());
 		}
 
 		ImGui::End();
@@ -234,12 +350,80 @@ public:
 		Render(); // continuously render frames
 	}
 
+	// the mouse over the viewport is the focus of the priority tiles, a left drag crops the rendering.
+	// the image is shown upside down (see the uv coordinates of ImGui::Image), row 0 is at the bottom
+	void UpdateViewportInput(const ImVec2& origin, uint32_t width, uint32_t height)
+	{
+		auto toPixel = [&](const ImVec2& screen) {
+			float x = glm::clamp(screen.x - origin.x, 0.0f, (float)width - 1.0f);
+			float y = glm::clamp((float)height - (screen.y - origin.y), 0.0f, (float)height - 1.0f);
+			return glm::vec2(x, y);
+		};
+		auto toScreen = [&](float x, float y) {
+			return ImVec2(origin.x + x, origin.y + (float)height - y);
+		};
+
+		glm::vec2 mouse = toPixel(ImGui::GetMousePos());
+		if (ImGui::IsItemHovered() && m_FocusSphere < 0)
+		{
+			m_Renderer.SetFocus((uint32_t)mouse.x, (uint32_t)mouse.y);
+		}
+
+		if (ImGui::IsItemActivated())
+		{
+			m_CropStart = mouse;
+		}
+		bool dragged = glm::length(mouse - m_CropStart) > 2.0f;
+		glm::vec2 cropMin = glm::min(m_CropStart, mouse);
+		glm::vec2 cropMax = glm::max(m_CropStart, mouse);
+		if (ImGui::IsItemActive() && dragged)
+		{
+			ImGui::GetWindowDrawList()->AddRect(toScreen(cropMin.x, cropMax.y), toScreen(cropMax.x, cropMin.y), IM_COL32(255, 255, 255, 255));
+		}
+		else if (m_Renderer.HasRegionOfInterest())
+		{
+			glm::uvec4 crop = m_Renderer.GetRegionOfInterest();
+			ImGui::GetWindowDrawList()->AddRect(toScreen((float)crop.x, (float)(crop.y + crop.w)), toScreen((float)(crop.x + crop.z), (float)crop.y), IM_COL32(235, 75, 75, 255));
+		}
+		if (ImGui::IsItemDeactivated() && dragged)
+		{
+			m_Renderer.SetRegionOfInterest((uint32_t)cropMin.x, (uint32_t)cropMin.y, (uint32_t)(cropMax.x - cropMin.x) + 1, (uint32_t)(cropMax.y - cropMin.y) + 1);
+		}
+	}
+
+	// the priority tiles spiral out from where the selected sphere is on the screen
+	void FocusOnSphere()
+	{
+		if (m_FocusSphere < 0 || m_FocusSphere >= (int)m_Scene.Spheres.size())
+			return;
+
+		glm::vec4 clip = m_Camera.GetProjection() * m_Camera.GetView() * glm::vec4(m_Scene.Spheres[m_FocusSphere].Position, 1.0f);
+		if (clip.w <= 0.0f)
+			return;
+		glm::vec2 ndc = glm::vec2(clip) / clip.w;
+		glm::vec2 pixel = (ndc + 1.0f) * 0.5f * glm::vec2((float)m_ViewportWidth, (float)m_ViewportHeight);
+		if (pixel.x >= 0.0f && pixel.y >= 0.0f)
+		{
+			m_Renderer.SetFocus((uint32_t)pixel.x, (uint32_t)pixel.y);
+		}
+	}
+
 	void Render()
 	{
 		Timer timer; // monitor frametimes with timer object
 
+		// a scene finished loading in the background: swap it in before the next frame starts
+		if (std::unique_ptr<LoadedScene> loaded = m_SceneLoader.TakeLoadedScene())
+		{
+			m_Scene = std::move(loaded->scene);
+			m_Renderer.AdoptAccelerationStructure(std::move(loaded->bvh), m_Scene);
+			m_Renderer.FrameCountReset();
+		}
+
 		m_Renderer.onResize(m_ViewportWidth, m_ViewportHeight);
+		m_Camera.SetRayDirectionCache(m_Renderer.WantsRayDirectionCache());
 		m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
+		FocusOnSphere();
 		m_Renderer.Render(m_Scene, m_Camera);
 
 		m_LastRenderTime = timer.ElapsedMillis();
@@ -250,6 +434,13 @@ private:
 	Renderer m_Renderer;
 	Camera m_Camera; // create a camera object from the external camera class
 	Scene m_Scene;
+	SceneLoader m_SceneLoader;
+	char m_SceneFile[256] = "scene.txt";
+	char m_EnvironmentFile[256] = "environment.hdr";
+	std::string m_EnvironmentError;
+	char m_CheckpointFile[256] = "render.ckpt";
+	float m_CheckpointInterval = 30.0f;
+	bool m_CheckpointOverwrite = false; // a file of another size or no checkpoint at all is only replaced with this
 
 	uint32_t* m_ImageData = nullptr;
 
@@ -257,10 +448,28 @@ private:
 	uint32_t m_ViewportHeight = 0;
 
 	float m_LastRenderTime = 0.0f;
+
+	int m_FocusSphere = -1; // -1 focuses the priority tiles on the mouse
+	glm::vec2 m_CropStart{ 0.0f };
+	bool m_RenderEditedMaterialOnly = false;
+
+	bool m_AnimateScene = false;
+	float m_AnimationTime = 0.0f;
+
+	std::vector<Renderer::ShadingBenchmark> m_ShadingBenchmark;
+	std::vector<Renderer::AccelerationBenchmark> m_AccelerationBenchmark;
+	std::vector<Renderer::AccelerationBenchmark> m_BounceHeavyBenchmark;
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
 {
+	int exitCode = CommandLine::Run(argc, argv);
+	if (exitCode >= 0)
+	{
+		// a mode without window ran, there is nothing left to do
+		std::exit(exitCode);
+	}
+
 	Walnut::ApplicationSpecification appSpecification;
 	appSpecification.Name = "Raytrace Project by Marvin Geiger";
 
@@ -0,0 +1,41 @@
+@echo off
+rem the same as TestDistributed.sh: renders one small image with one and with three local workers,
+rem and once more with a local worker plus a render server started here, all images have to be the same.
+rem usage: scripts\TestDistributed.bat <path to MGRaytrace.exe>
+
+if "%~1"=="" (
+	echo usage: %0 ^<path to MGRaytrace.exe^>
+	exit /b 1
+)
+set exe=%~f1
+set dir=%TEMP%\mgraytrace-test-%RANDOM%
+mkdir "%dir%"
+pushd "%dir%"
+
+set job=scene=default size=96x64 spp=48 tile=32 seed=7
+set server=tcp:39871
+set failed=0
+
+"%exe%" --coordinate one.ppm --workers 1 %job% || goto error
+"%exe%" --coordinate three.ppm --workers 3 %job% || goto error
+
+start /b "" "%exe%" --server %server% > server.log 2>&1
+rem remote workers are not waited for like local ones
+timeout /t 2 /nobreak > nul
+"%exe%" --coordinate remote.ppm --workers 1 --connect %server% %job%
+set result=%errorlevel%
+"%exe%" --stop-server %server% > nul
+if not %result%==0 goto error
+
+for %%i in (three.ppm remote.ppm) do (
+	fc /b one.ppm %%i > nul && (echo %%i: same as one worker) || (echo %%i: DIFFERS from one worker & set failed=1)
+)
+
+popd
+rmdir /s /q "%dir%"
+exit /b %failed%
+
+:error
+popd
+rmdir /s /q "%dir%"
+exit /b 1
@@ -0,0 +1,51 @@
+#!/bin/sh
+# renders the same small image with one and with three local workers, and once more with a local
+# worker plus a render server started here, and checks that all images are exactly the same.
+# usage: scripts/TestDistributed.sh <path to MGRaytrace>
+
+if [ -z "$1" ] || [ ! -x "$1" ]; then
+	echo "usage: $0 <path to MGRaytrace>"
+	exit 1
+fi
+exe=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# several tiles and several sample ranges per tile, so the workers really split the image
+job="scene=default size=96x64 spp=48 tile=32 seed=7"
+server="unix:$dir/server.sock"
+failed=0
+
+"$exe" --coordinate one.ppm --workers 1 $job > one.log || { cat one.log; exit 1; }
+"$exe" --coordinate three.ppm --workers 3 $job > three.log || { cat three.log; exit 1; }
+
+"$exe" --server "$server" > server.log 2>&1 &
+# remote workers are not waited for like local ones
+for attempt in $(seq 50); do
+	[ -S "$dir/server.sock" ] && break
+	sleep 0.1
+done
+"$exe" --coordinate remote.ppm --workers 1 --connect "$server" $job > remote.log
+result=$?
+"$exe" --stop-server "$server" > /dev/null
+wait
+if [ $result -ne 0 ]; then
+	cat remote.log server.log
+	exit 1
+fi
+
+for image in three.ppm remote.ppm; do
+	if cmp -s one.ppm "$image"; then
+		echo "$image: same as one worker"
+	else
+		echo "$image: DIFFERS from one worker"
+		failed=1
+	fi
+done
+
+# how the units were split, a worker with 0 units makes the comparison weaker
+grep -h " rendered .* units" three.log remote.log
+
+exit $failed